@@ -0,0 +1,80 @@
+#ifndef AGGREGATES_H
+#define AGGREGATES_H
+#include <core.h>
+#include <ledger.h>
+
+#include <limits>
+#include <utility>
+#include <vector>
+
+namespace simulation {
+
+// Summed statistics of one node of the aggregate tree
+struct Totals {
+  i64 population{0};
+  i64 buildings{0};
+  // Goods produced per day, all goods counted alike
+  f64 output{0.0};
+  // Value of the goods produced on the last day
+  Money gdp{0};
+
+  Totals& operator+=(const Totals& other) {
+    this->population += other.population;
+    this->buildings += other.buildings;
+    this->output += other.output;
+    this->gdp += other.gdp;
+    return *this;
+  }
+
+  Totals& operator-=(const Totals& other) {
+    this->population -= other.population;
+    this->buildings -= other.buildings;
+    this->output -= other.output;
+    this->gdp -= other.gdp;
+    return *this;
+  }
+};
+
+// Location -> country -> world sums, kept up to date by deltas. Reads are
+// O(1) and an update touches one node per level. Nodes are pool slots.
+class Aggregates {
+public:
+  static constexpr u32 NIL = std::numeric_limits<u32>::max();
+
+private:
+  std::vector<Totals> locations;
+  std::vector<Totals> countries;
+  Totals world;
+  // Country slot of every location, NIL when unowned
+  std::vector<u32> owner;
+  // Bumped whenever any location changes owner
+  u64 owners_version{0};
+
+  // Deltas recorded during parallel phases, one list per thread
+  std::vector<std::vector<std::pair<u32, Totals>>> pending;
+
+public:
+  void Init(usize num_locations, usize num_countries, usize num_threads);
+
+  // Applies a delta right away. Not safe to call from parallel systems.
+  void Add(u32 location, const Totals& delta);
+
+  // Moves a location, with everything summed in it, to another country
+  void SetOwner(u32 location, u32 country);
+
+  // Records a delta from a parallel system, applied by Flush
+  void Record(u32 location, const Totals& delta);
+  void Flush();
+
+  const Totals& AtLocation(u32 location) const {
+    return this->locations[location];
+  }
+  const Totals& AtCountry(u32 country) const {
+    return this->countries[country];
+  }
+  const Totals& World() const { return this->world; }
+  u64 OwnersVersion() const { return this->owners_version; }
+};
+
+} // namespace simulation
+#endif
@@ -115,6 +115,7 @@ public:
       InitChunk(*this->arena, *new_chunk, this->chunk_capacity);
       last->next = new_chunk;
       this->head->tail = new_chunk;
+      last = new_chunk;
     }
     // Push into position
     last->buffer[last->length] = std::move(value);
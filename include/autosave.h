@@ -0,0 +1,51 @@
+#ifndef AUTOSAVE_H
+#define AUTOSAVE_H
+#include <core.h>
+#include <save.h>
+
+#include <sys/types.h>
+
+namespace simulation {
+
+struct Sim;
+
+enum class AutosaveStatus {
+  // No save in flight and nothing to report
+  Idle,
+  InFlight,
+  Done,
+  Failed,
+};
+
+// Background saves through fork(). The child writes its copy-on-write view
+// of the sim with SaveSimCompressed while the parent keeps ticking, and
+// reports back through a pipe. One save is in flight at a time.
+//
+// A failed delta breaks its chain; Reset the SaveChain on Failed.
+class Autosave {
+private:
+  pid_t child{-1};
+  int pipe_fd{-1};
+
+  AutosaveStatus Reap(bool ok);
+
+public:
+  Autosave() = default;
+  Autosave(const Autosave& other) = delete;
+  ~Autosave();
+
+  // Call at a tick boundary. Returns false if a save is already in flight or
+  // the fork failed.
+  bool Start(const Sim& sim, const char* path, const SavePlan& plan = {});
+
+  // Never blocks. Reports Done or Failed once per save, then Idle.
+  AutosaveStatus Poll();
+
+  // Blocks until the save in flight, if any, completes
+  AutosaveStatus Wait();
+
+  bool InFlight() const { return this->child > 0; }
+};
+
+} // namespace simulation
+#endif
@@ -0,0 +1,21 @@
+#ifndef COHORTS_H
+#define COHORTS_H
+#include <core.h>
+
+#include <span>
+
+namespace simulation {
+
+struct Sim;
+struct Location;
+
+// Pops are cohorts: a location holds at most one pop per type. Merging
+// folds every later pop of a type into the first one, summing sizes and
+// money, and leaves a forward on the merged pop for Resolve. Pending events
+// naming a merged pop are pointed at the pop that absorbed it. Call between
+// ticks. Returns the number of pops merged away.
+usize MergeCohorts(Sim& sim, std::span<Location* const> locations);
+usize MergeAllCohorts(Sim& sim);
+
+} // namespace simulation
+#endif
@@ -0,0 +1,129 @@
+#ifndef COMMANDS_H
+#define COMMANDS_H
+#include <core.h>
+
+#include <vector>
+
+namespace simulation {
+
+struct Sim;
+struct Pop;
+struct PopType;
+struct Building;
+struct BuildingType;
+struct Location;
+struct Country;
+
+// Structural changes recorded during a parallel phase, applied later by
+// ApplyCommands.
+enum class CommandKind {
+  CreatePop,
+  CreateBuilding,
+  DestroyPop,
+  DestroyBuilding,
+  MovePop,
+  ChangeOwner,
+  TransferAll,
+};
+
+struct Command {
+  CommandKind kind{CommandKind::CreatePop};
+  // Merge key. Commands are applied sorted by (order, seq), so `order` must
+  // name the recording source (e.g. the index of the entity being processed)
+  // and all commands sharing a key must be recorded by the same task.
+  u64 order{0};
+  u64 seq{0};
+
+  const PopType* pop_type{nullptr};
+  const BuildingType* building_type{nullptr};
+  Pop* pop{nullptr};
+  Building* building{nullptr};
+  Location* location{nullptr};
+  Country* country{nullptr};
+  // Source of TransferAll
+  Country* from_country{nullptr};
+  i64 size{0};
+};
+
+class CommandBuffer {
+private:
+  std::vector<Command> commands;
+
+  void Push(Command command) {
+    command.seq = this->commands.size();
+    this->commands.push_back(command);
+  }
+
+public:
+  void CreatePop(u64 order, const PopType* type, Location* location, i64 size) {
+    this->Push(Command{.kind = CommandKind::CreatePop,
+        .order = order,
+        .pop_type = type,
+        .location = location,
+        .size = size});
+  }
+
+  void CreateBuilding(
+      u64 order, const BuildingType* type, Location* location, i64 size) {
+    this->Push(Command{.kind = CommandKind::CreateBuilding,
+        .order = order,
+        .building_type = type,
+        .location = location,
+        .size = size});
+  }
+
+  void DestroyPop(u64 order, Pop* pop) {
+    this->Push(
+        Command{.kind = CommandKind::DestroyPop, .order = order, .pop = pop});
+  }
+
+  void DestroyBuilding(u64 order, Building* building) {
+    this->Push(Command{.kind = CommandKind::DestroyBuilding,
+        .order = order,
+        .building = building});
+  }
+
+  void MovePop(u64 order, Pop* pop, Location* location) {
+    this->Push(Command{.kind = CommandKind::MovePop,
+        .order = order,
+        .pop = pop,
+        .location = location});
+  }
+
+  void ChangeOwner(u64 order, Location* location, Country* country) {
+    this->Push(Command{.kind = CommandKind::ChangeOwner,
+        .order = order,
+        .location = location,
+        .country = country});
+  }
+
+  // Moves every location of `from` to `to`
+  void TransferAll(u64 order, Country* from, Country* to) {
+    this->Push(Command{.kind = CommandKind::TransferAll,
+        .order = order,
+        .country = to,
+        .from_country = from});
+  }
+
+  bool IsEmpty() const { return this->commands.empty(); }
+
+  friend void ApplyCommands(Sim& sim);
+};
+
+// One buffer per worker thread, so recording never needs a lock.
+struct Commands {
+  std::vector<CommandBuffer> buffers;
+
+  void Init(usize num_threads) { this->buffers.resize(num_threads); }
+
+  // Buffer owned by the calling thread
+  CommandBuffer& Local();
+};
+
+// Applies every recorded command in a single deterministic pass and clears
+// the buffers. Pop and building lists are rebuilt once per touched location
+// rather than edited per command; ownership changes are O(1) each.
+void ApplyCommands(Sim& sim);
+
+} // namespace simulation
+#endif
@@ -0,0 +1,80 @@
+#ifndef CONCURRENT_H
+#define CONCURRENT_H
+#include <core.h>
+
+#include <array>
+#include <atomic>
+#include <optional>
+
+namespace concurrent {
+
+// Bounded lock-free queue for exactly one producer and one consumer thread.
+template <typename T, usize N> class SpscQueue {
+  static_assert((N & (N - 1)) == 0, "capacity must be a power of two");
+
+private:
+  std::array<T, N> slots;
+  alignas(64) std::atomic<usize> head{0};
+  alignas(64) std::atomic<usize> tail{0};
+
+public:
+  // Producer side. Returns false when the queue is full.
+  bool Push(T value) {
+    usize tail = this->tail.load(std::memory_order_relaxed);
+    if (tail - this->head.load(std::memory_order_acquire) >= N) {
+      return false;
+    }
+    this->slots[tail & (N - 1)] = std::move(value);
+    this->tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side
+  std::optional<T> Pop() {
+    usize head = this->head.load(std::memory_order_relaxed);
+    if (head == this->tail.load(std::memory_order_acquire)) {
+      return std::nullopt;
+    }
+    T value = std::move(this->slots[head & (N - 1)]);
+    this->head.store(head + 1, std::memory_order_release);
+    return value;
+  }
+};
+
+// Three slots of T shared by one writer and one reader. The writer fills
+// its back slot and publishes it; the reader picks up the most recent
+// publication. Neither side ever waits for the other.
+template <typename T> class TripleBuffer {
+private:
+  static constexpr u32 INDEX_MASK = 0x3;
+  static constexpr u32 FRESH = 0x4;
+
+  std::array<T, 3> slots;
+  // Index of the slot in the middle, plus FRESH when it was not read yet
+  alignas(64) std::atomic<u32> middle{1};
+  // Owned by the writer
+  alignas(64) u32 back{0};
+  // Owned by the reader
+  alignas(64) u32 front{2};
+
+public:
+  // Writer side
+  T& Back() { return this->slots[this->back]; }
+
+  void Publish() {
+    u32 prev = this->middle.exchange(this->back | FRESH, std::memory_order_acq_rel);
+    this->back = prev & INDEX_MASK;
+  }
+
+  // Reader side. Swaps in the latest publication, if any, and returns it.
+  const T& Acquire() {
+    if (this->middle.load(std::memory_order_relaxed) & FRESH) {
+      u32 prev = this->middle.exchange(this->front, std::memory_order_acq_rel);
+      this->front = prev & INDEX_MASK;
+    }
+    return this->slots[this->front];
+  }
+};
+
+} // namespace concurrent
+#endif
@@ -0,0 +1,88 @@
+#ifndef DIGEST_H
+#define DIGEST_H
+#include <core.h>
+
+#include <array>
+#include <vector>
+
+// Hashes of the simulation state, for checking cheaply that two runs are
+// still in step. They cover what a save covers.
+//
+// Every entity hashes to one value keyed by its slot, and a pool's digest
+// is the sum of those. The sum does not depend on the order slots are
+// visited in, and a changed entity moves it by its new hash minus its old
+// one, so only the entities touched since the last update are rehashed.
+namespace simulation {
+
+struct Sim;
+
+enum class DigestPart : u32 {
+  Pops,
+  Buildings,
+  Locations,
+  Countries,
+  // Date, ledger, markets, events and everything else outside the pools
+  Globals,
+  COUNT,
+};
+
+static const usize NUM_DIGEST_PARTS = usize(DigestPart::COUNT);
+
+const char* ToString(DigestPart part);
+
+struct Digest {
+  std::array<u64, NUM_DIGEST_PARTS> parts{};
+
+  // All parts folded into one value
+  u64 Whole() const;
+
+  bool operator==(const Digest& other) const = default;
+};
+
+// Where two runs first differ
+struct Divergence {
+  DigestPart part{DigestPart::Globals};
+  // First slot whose entity differs; unset for Globals
+  u32 slot{0};
+};
+
+struct PoolHashes {
+  // Per slot, as of the last update; 0 above the frontier
+  std::vector<u64> slots;
+  u64 sum{0};
+  // Change period the last update ended, see Pool::Checkpoint
+  u32 since{0};
+};
+
+class StateHasher {
+private:
+  // One per pool part
+  std::array<PoolHashes, usize(DigestPart::Globals)> pools;
+  Digest digest;
+
+public:
+  // Rehashes the entities changed since the previous call; the first call
+  // hashes everything. Call at a tick boundary. Ends a change period in
+  // every pool, which other users of the stamps do not mind.
+  const Digest& Update(Sim& sim);
+
+  // Drops all hashes. Call after the sim is loaded or rebuilt.
+  void Reset();
+
+  const Digest& Last() const { return this->digest; }
+
+  // Hash of the entity in `slot` of a pool part, as of the last update
+  u64 SlotHash(DigestPart part, u32 slot) const;
+
+  // First part and slot where the last updates of two hashers disagree.
+  // False when they agree.
+  friend bool FindDivergence(
+      const StateHasher& a, const StateHasher& b, Divergence& divergence);
+};
+
+// From scratch and without ending a change period. Equal to what a
+// StateHasher kept up to date reports.
+Digest DigestSim(const Sim& sim);
+
+} // namespace simulation
+#endif
@@ -0,0 +1,104 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+#include <core.h>
+
+#include <array>
+#include <span>
+#include <vector>
+
+// Bounded history of market and location statistics, for charts.
+//
+// Recent days are kept as daily samples. Older data survives only as
+// weekly, monthly and yearly buckets holding the min, max and mean of the
+// days they cover. Every tier is a fixed-size ring per series, so memory
+// does not grow with the length of the game.
+//
+// Each (metric, tier, stat) is its own column, laid out series by series.
+// Rings are mirrored, every value written twice, so the latest n entries of
+// a series are always one contiguous slice.
+namespace simulation {
+
+struct Sim;
+
+enum class Metric : u32 {
+  // Per market, that is per (location, good)
+  Price,
+  Supply,
+  // Per location
+  Population,
+  COUNT,
+};
+
+enum class Tier : u32 {
+  Daily,
+  Weekly,
+  Monthly,
+  Yearly,
+  COUNT,
+};
+
+// Daily samples have a single value, read as any stat
+enum class Stat : u32 {
+  Min,
+  Max,
+  Mean,
+  COUNT,
+};
+
+static const usize NUM_METRICS = usize(Metric::COUNT);
+static const usize NUM_TIERS = usize(Tier::COUNT);
+static const usize NUM_STATS = usize(Stat::COUNT);
+
+struct HistoryOptions {
+  // Entries kept per series in each tier
+  std::array<usize, NUM_TIERS> capacity{90, 52, 60, 50};
+};
+
+class History {
+private:
+  struct Ring {
+    usize capacity{0};
+    // Next slot to write
+    usize head{0};
+    usize count{0};
+    // Days sampled since the last bucket was closed
+    usize pending{0};
+    // One column per stat, 2 * capacity values per series
+    std::array<std::vector<f32>, NUM_STATS> columns;
+  };
+
+  HistoryOptions options;
+  std::array<usize, NUM_METRICS> num_series{};
+  std::array<std::array<Ring, NUM_TIERS>, NUM_METRICS> rings;
+  usize num_goods{0};
+
+  void Push(Metric metric, Tier tier, usize series, f32 min, f32 max, f32 mean);
+  void Advance(Metric metric, Tier tier);
+  void CloseBucket(Metric metric, Tier tier, Tier from, usize span);
+
+public:
+  // Sizes the store for the sim's markets and locations and drops any
+  // history held
+  void Init(const Sim& sim, const HistoryOptions& options = {});
+
+  // Call once after every tick. Reinitializes if the sim was rebuilt.
+  void Sample(const Sim& sim);
+
+  usize SeriesOf(usize location, usize good) const {
+    return location * this->num_goods + good;
+  }
+
+  // Entries held for every series of a metric in one tier
+  usize Count(Metric metric, Tier tier) const {
+    return this->rings[usize(metric)][usize(tier)].count;
+  }
+
+  // The latest n entries of a series, oldest first. n is clamped to Count.
+  std::span<const f32> Latest(
+      Metric metric, Tier tier, Stat stat, usize series, usize n) const;
+
+  usize Bytes() const;
+};
+
+} // namespace simulation
+#endif
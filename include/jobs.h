@@ -0,0 +1,60 @@
+#ifndef JOBS_H
+#define JOBS_H
+#include <core.h>
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+// Small fixed-size worker pool shared by the whole process.
+// The calling thread always takes part in the work, so a pool with
+// zero extra threads degrades to plain serial execution.
+namespace jobs {
+
+using Task = std::function<void(usize)>;
+using RangeTask = std::function<void(usize, usize)>;
+
+// Spawns `num_threads - 1` workers. Zero picks the hardware concurrency.
+void Init(usize num_threads = 0);
+void Shutdown();
+
+// Number of threads (workers plus the caller) work is spread over.
+usize NumThreads();
+
+// Index of the current thread in [0, NumThreads()). The thread that called
+// Init is always index 0.
+usize ThreadIndex();
+
+// Runs task(i) for every i in [0, count) and blocks until all are done.
+// Nested calls from inside a task run serially on the calling thread.
+void Run(usize count, const Task& task);
+
+// Splits [begin, end) in chunks of `chunk` items and runs them through Run.
+void ParallelFor(usize begin, usize end, usize chunk, const RangeTask& task);
+
+// Deterministic parallel reduction. [begin, end) is cut into blocks of
+// `block` items regardless of the thread count, map(lo, hi) reduces each
+// block serially, and the block results are combined pairwise in a fixed
+// tree. Floating point sums come out bit-identical with 1 thread or 32.
+template <typename T, typename Map, typename Combine>
+T Reduce(usize begin, usize end, usize block, T identity, Map map,
+    Combine combine) {
+  if (end <= begin) {
+    return identity;
+  }
+  block = std::max<usize>(block, 1);
+  usize num_blocks = (end - begin + block - 1) / block;
+  std::vector<T> partial(num_blocks, identity);
+  Run(num_blocks, [&](usize i) {
+    usize lo = begin + i * block;
+    partial[i] = map(lo, std::min(end, lo + block));
+  });
+  for (usize width = 1; width < num_blocks; width *= 2) {
+    for (usize i = 0; i + width < num_blocks; i += 2 * width) {
+      partial[i] = combine(partial[i], partial[i + width]);
+    }
+  }
+  return partial[0];
+}
+
+} // namespace jobs
+#endif
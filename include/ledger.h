@@ -0,0 +1,93 @@
+#ifndef LEDGER_H
+#define LEDGER_H
+#include <core.h>
+
+#include <cmath>
+#include <vector>
+
+namespace simulation {
+
+struct Sim;
+
+// Amounts are counted in the smallest currency unit, so transfers add up
+// exactly and money can be checked for conservation.
+using Money = i64;
+
+// Money units per 1.0 of price
+static const Money MONEY_UNIT = 100;
+
+enum class AccountKind : u8 {
+  // Everything outside the simulated economy. Its balance may go negative.
+  World,
+  Country,
+  Pop,
+  Building,
+};
+
+// Account holder, by pool slot
+struct Account {
+  AccountKind kind{AccountKind::World};
+  u32 index{0};
+};
+
+struct Transaction {
+  Account from;
+  Account to;
+  Money amount{0};
+};
+
+class LedgerBuffer {
+private:
+  std::vector<Transaction> transactions;
+
+public:
+  void Transfer(Account from, Account to, Money amount) {
+    if (amount != 0) {
+      this->transactions.push_back({from, to, amount});
+    }
+  }
+
+  bool IsEmpty() const { return this->transactions.empty(); }
+
+  friend void ApplyLedger(Sim& sim);
+};
+
+// Money moved in and out of a country's accounts by the last apply. Covers
+// the country itself plus the pops and buildings in its locations.
+struct CountryFlows {
+  Money inflow{0};
+  Money outflow{0};
+};
+
+// Double-entry ledger. Systems record transfers into their thread's buffer;
+// ApplyLedger posts them all at the end of the tick.
+struct Ledger {
+  std::vector<LedgerBuffer> buffers;
+  Money world{0};
+  // Indexed by country slot
+  std::vector<CountryFlows> country_flows;
+
+  // Stats of the last apply
+  usize transactions_applied{0};
+
+  void Init(usize num_threads) { this->buffers.resize(num_threads); }
+
+  // Buffer owned by the calling thread
+  LedgerBuffer& Local();
+};
+
+static inline Money ToMoney(f64 value) {
+  return std::llround(value * f64(MONEY_UNIT));
+}
+
+// Posts every recorded transfer and clears the buffers. Postings are grouped
+// by account into one shard per thread, so each balance is only ever touched
+// by one thread and no atomics are needed. Debug builds check that the total
+// amount of money did not change.
+void ApplyLedger(Sim& sim);
+
+// Sum of all balances, the world account included
+Money TotalMoney(const Sim& sim);
+
+} // namespace simulation
+#endif
@@ -0,0 +1,92 @@
+#ifndef MAP_INDEX_H
+#define MAP_INDEX_H
+#include <raylib.h>
+
+#include <core.h>
+#include <simulation.h>
+
+#include <algorithm>
+#include <optional>
+#include <vector>
+
+// Uniform grid over map item bounds, for culling and picking.
+//
+// Each item is filed under the one cell holding its center, and queries
+// grow their area by the largest item half size instead. So an item is
+// visited at most once and nothing needs deduplicating. Cells are numbered
+// tile by tile, 16x16 cells to a tile, and tiles in Z order, which keeps
+// items that are close on the map close in Entries order too.
+namespace render {
+
+struct MapItemState {
+  simulation::EntityId id;
+  // Country slot, see MapItem
+  u32 owner{0};
+  Rectangle bounds;
+  Color fill;
+  Color border;
+};
+
+class MapIndex {
+private:
+  Rectangle area{};
+  f32 cell_size{1.0f};
+  // Largest half width and half height of any item
+  f32 reach_x{0.0f};
+  f32 reach_y{0.0f};
+  usize columns{0};
+  usize rows{0};
+  usize tiles_x{0};
+  // Rank of each tile, row-major, in Z order
+  std::vector<u32> tile_order;
+  // Start of each cell in `entries`, by cell key, plus an end marker
+  std::vector<u32> cell_start;
+  // Item indices ordered by cell key; a position here is an item's slot
+  std::vector<u32> entries;
+  // Bounds by slot
+  std::vector<Rectangle> bounds;
+
+  usize KeyOf(usize column, usize row) const;
+  usize ColumnOf(f32 x) const;
+  usize RowOf(f32 y) const;
+
+public:
+  void Build(const std::vector<MapItemState>& items);
+
+  // Item index for each slot
+  const std::vector<u32>& Entries() const { return this->entries; }
+  // Union of all item bounds
+  Rectangle Area() const { return this->area; }
+
+  // Calls fn(slot, index) for every item whose bounds overlap `query`
+  template <typename F> void Query(Rectangle query, F fn) const {
+    if (this->entries.empty()) {
+      return;
+    }
+    usize first_column = this->ColumnOf(query.x - this->reach_x);
+    usize last_column = this->ColumnOf(query.x + query.width + this->reach_x);
+    usize first_row = this->RowOf(query.y - this->reach_y);
+    usize last_row = this->RowOf(query.y + query.height + this->reach_y);
+    for (usize row = first_row; row <= last_row; ++row) {
+      for (usize column = first_column; column <= last_column; ++column) {
+        usize key = this->KeyOf(column, row);
+        for (u32 slot = this->cell_start[key]; slot < this->cell_start[key + 1];
+             ++slot) {
+          const auto& item = this->bounds[slot];
+          if (item.x <= query.x + query.width && query.x <= item.x + item.width &&
+              item.y <= query.y + query.height && query.y <= item.y + item.height) {
+            fn(slot, this->entries[slot]);
+          }
+        }
+      }
+    }
+  }
+
+  // The item drawn on top at `point`, as an item index
+  std::optional<u32> Pick(Vector2 point) const;
+  // Item indices overlapping `query`, ascending
+  void Select(Rectangle query, std::vector<u32>& out) const;
+};
+
+} // namespace render
+#endif
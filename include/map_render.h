@@ -0,0 +1,134 @@
+#ifndef MAP_RENDER_H
+#define MAP_RENDER_H
+#include <raylib.h>
+
+#include <core.h>
+#include <map_index.h>
+#include <runner.h>
+#include <simulation.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// Map drawing from vertex buffers kept on the GPU. Each item is a border
+// quad with an inset fill quad on top, the same pixels DrawRectanglePro
+// plus DrawRectangleLinesEx would give. Items are split into chunks, one
+// mesh each, and a chunk draws in a single call.
+//
+// Sync compares a snapshot against what was uploaded and only rewrites
+// the vertex ranges of items that changed color or selection. Items are
+// laid out in MapIndex slot order, so a chunk covers one patch of the map
+// and Draw can skip the chunks outside the view. Moving any item lays
+// everything out again; coordinates are not expected to change often.
+//
+// Zoomed out, items shrink below a few pixels and Draw switches to a
+// cluster level instead: a grid whose cells are 4, 16, 64... item spacings
+// wide, one quad per cell in the color of the country owning most of it.
+// Levels are built when first drawn and kept until an owner changes.
+namespace render {
+
+// World units per map coordinate
+static const f32 MAP_SCALE = 40.0f;
+static const f32 BORDER_WIDTH = 4.0f;
+// Screen pixels between items below which clusters are drawn instead
+static const f32 LOD_PIXELS = 8.0f;
+
+class MapRenderer {
+private:
+  struct Range {
+    usize begin{0};
+    usize end{0};
+
+    void Add(usize item) {
+      if (this->begin == this->end) {
+        *this = {item, item + 1};
+      } else {
+        this->begin = std::min(this->begin, item);
+        this->end = std::max(this->end, item + 1);
+      }
+    }
+    bool IsEmpty() const { return this->begin == this->end; }
+  };
+
+  struct Chunk {
+    Mesh mesh{};
+    // First slot of the chunk
+    usize first{0};
+    usize num_items{0};
+    bool uploaded{false};
+    // Items to upload again, chunk relative
+    Range positions;
+    Range colors;
+    // Corners of everything written to the chunk
+    Vector2 low{INFINITY, INFINITY};
+    Vector2 high{-INFINITY, -INFINITY};
+  };
+
+  struct Level {
+    // Cell side in world units
+    f32 cell_size{0.0f};
+    bool built{false};
+    std::vector<Chunk> chunks;
+  };
+
+  // By item index, the order of the snapshot's map items
+  std::vector<MapItemState> items;
+  std::vector<u32> slot_of;
+  std::vector<bool> marked;
+  MapIndex index;
+  std::vector<Chunk> chunks;
+  // Average distance between items, in world units
+  f32 pitch{0.0f};
+  // Cluster levels, coarsest last
+  std::vector<Level> levels;
+  u64 owners_version{0};
+  usize drawn_level{0};
+  Material material{};
+  bool loaded{false};
+  u64 sequence{0};
+  simulation::EntityId selected_id;
+  // Marks changed since the last Sync
+  bool stale{false};
+
+  static void AllocateChunks(std::vector<Chunk>& chunks, usize num_items);
+  static void FreeChunks(std::vector<Chunk>& chunks);
+  static void WritePositions(Chunk& chunk, usize local, Rectangle bounds);
+  static void WriteColors(Chunk& chunk, usize local, Color border, Color fill);
+  static void Upload(Chunk& chunk);
+
+  void Layout();
+  void WriteItem(usize item, bool positions);
+  void BuildLevel(Level& level);
+  usize LevelFor(f32 zoom) const;
+
+public:
+  MapRenderer() = default;
+  MapRenderer(const MapRenderer& other) = delete;
+  ~MapRenderer();
+
+  // Needs the window, and so the GL context, to exist
+  void Init();
+  void Unload();
+
+  // Cheap when neither the snapshot nor the selection changed
+  void Sync(const runner::Snapshot& snapshot, simulation::EntityId selected_id);
+
+  // Call between BeginMode2D and EndMode2D with the same camera. Draws
+  // only the chunks in view, of the level the camera's zoom calls for.
+  void Draw(const Camera2D& camera);
+
+  // Item on top at a world position, or null
+  simulation::EntityId Pick(Vector2 world) const;
+  // Item indices overlapping a world rectangle, ascending
+  void Select(Rectangle world, std::vector<u32>& out) const;
+  // Outlines items by index, replacing any earlier marks
+  void Mark(const std::vector<u32>& indices);
+
+  const std::vector<MapItemState>& Items() const { return this->items; }
+  // 0 for items, then cluster levels from the finest
+  usize DrawnLevel() const { return this->drawn_level; }
+};
+
+} // namespace render
+#endif
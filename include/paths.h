@@ -0,0 +1,64 @@
+#ifndef PATHS_H
+#define PATHS_H
+#include <core.h>
+
+#include <array>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace simulation {
+
+class LocationGraph;
+
+// Travel cost queries between locations, answered with A* over the location
+// graph guided by landmark (ALT) lower bounds. Exact answers are cached
+// until the graph changes. Queries may come from several threads at once,
+// but not while Sync or OnCostChanged run.
+class PathService {
+private:
+  const LocationGraph* graph{nullptr};
+  u64 graph_version{0};
+  usize num_nodes{0};
+  usize max_landmarks{8};
+
+  std::vector<u32> landmarks;
+  // Distance from landmark i to node v at i * num_nodes + v
+  std::vector<f64> landmark_dist;
+
+  // Answers are spread over shards by key, each with its own lock, so
+  // parallel callers rarely wait on each other. A full shard starts over.
+  struct CacheShard {
+    std::mutex mutex;
+    std::unordered_map<u64, f64> entries;
+  };
+  static constexpr usize CACHE_SHARDS = 16;
+  static constexpr usize CACHE_SHARD_CAPACITY = 1 << 14;
+  std::array<CacheShard, CACHE_SHARDS> cache;
+
+  CacheShard& ShardOf(u64 key);
+  void ClearCache();
+  void PickLandmarks();
+  void ComputeLandmark(usize landmark);
+  void Relax(usize landmark, u32 node);
+
+public:
+  // Rebuilds all tables if the graph structure changed since the last call
+  void Sync(const LocationGraph& graph);
+
+  // Admissible lower bound on the travel cost, in O(landmarks)
+  f64 LowerBound(u32 from, u32 to) const;
+
+  // Exact travel cost, infinity when unreachable
+  f64 Distance(u32 from, u32 to);
+
+  // Keeps the tables exact after the graph changed the cost of edge (a, b).
+  // Decreases are propagated from the edge; an increase only recomputes
+  // the landmarks whose shortest path tree used the edge.
+  void OnCostChanged(u32 a, u32 b, f64 old_cost, f64 new_cost);
+
+  usize NumLandmarks() const { return this->landmarks.size(); }
+};
+
+} // namespace simulation
+#endif
@@ -1,7 +1,9 @@
 #ifndef POOL_H
 #define POOL_H
 
+#include <algorithm>
 #include <cassert>
+#include <span>
 #include <string>
 #include <vector>
 #include <core.h>
@@ -13,6 +15,9 @@ class Pool {
 private:
   std::vector<T> entries;
   std::vector<bool> check;
+  // Change period in which each slot was last touched, see Checkpoint
+  std::vector<u32> stamps;
+  u32 stamp{1};
   std::vector<T*> free_list;
   usize frontier{0};
   usize num_allocated{0};
@@ -44,6 +49,7 @@ public:
     this->name = name;
     this->entries.resize(capacity);
     this->check.resize(capacity, false);
+    this->stamps.resize(capacity, 0);
   }
 
   Pool(const Pool& other) = delete;
@@ -65,12 +71,16 @@ public:
       out = *this->free_list.rbegin();
       this->free_list.pop_back();
     }
+    // Keep the generation across reuse, so stale handles stay stale
+    auto generation = out->generation;
     *out = {};
+    out->generation = generation;
 
     auto in_range = this->CheckRange(*out);
     assert(in_range.contained);
     assert(!this->check[in_range.idx]);
     this->check[in_range.idx] = true;
+    this->stamps[in_range.idx] = this->stamp;
 
     this->num_allocated++;
 
@@ -83,6 +93,7 @@ public:
 
     assert(this->check[in_range.idx]);
     this->check[in_range.idx] = false;
+    this->stamps[in_range.idx] = this->stamp;
 
     this->free_list.push_back(&item);
 
@@ -90,10 +101,88 @@ public:
     this->num_allocated--;
   }
 
+  usize Capacity() const {
+    return this->entries.size();
+  }
+
+  usize IndexOf(const T& item) const {
+    auto in_range = this->CheckRange(item);
+    assert(in_range.contained);
+    return in_range.idx;
+  }
+
+  T& operator[](usize idx) {
+    assert(idx < this->entries.size());
+    return this->entries[idx];
+  }
+
+  const T& operator[](usize idx) const {
+    assert(idx < this->entries.size());
+    return this->entries[idx];
+  }
+
   usize NumAllocated() const {
     return this->num_allocated;
   }
 
+  // Slots past the frontier have never been allocated
+  usize Frontier() const {
+    return this->frontier;
+  }
+
+  T* Data() {
+    return this->entries.data();
+  }
+
+  const T* Data() const {
+    return this->entries.data();
+  }
+
+  // Records a change to an entry. Allocate and Deallocate touch on their
+  // own; everything else that writes saved state calls this. Safe from
+  // several threads as long as each entry is touched by one of them.
+  void Touch(const T& item) {
+    this->stamps[this->IndexOf(item)] = this->stamp;
+  }
+
+  // Ends the current change period and returns it. A slot changed after
+  // the call iff StampOf(slot) > the returned value. Call between ticks.
+  u32 Checkpoint() {
+    return this->stamp++;
+  }
+
+  u32 StampOf(usize idx) const {
+    assert(idx < this->stamps.size());
+    return this->stamps[idx];
+  }
+
+  // Free slots below the frontier, in reuse order (last reused first)
+  std::vector<u32> FreeSlots() const {
+    std::vector<u32> slots;
+    slots.reserve(this->free_list.size());
+    for (const T* item : this->free_list) {
+      slots.push_back(this->IndexOf(*item));
+    }
+    return slots;
+  }
+
+  // Rebuilds the allocation state after the entries were written directly,
+  // e.g. when loading a save
+  void Restore(usize frontier, std::span<const u32> free_slots) {
+    assert(frontier <= this->entries.size());
+    this->frontier = frontier;
+    this->check.assign(this->entries.size(), false);
+    std::fill(this->check.begin(), this->check.begin() + frontier, true);
+    this->stamps.assign(this->entries.size(), 0);
+    this->free_list.clear();
+    for (u32 slot : free_slots) {
+      assert(slot < frontier && this->check[slot]);
+      this->check[slot] = false;
+      this->free_list.push_back(&this->entries[slot]);
+    }
+    this->num_allocated = frontier - free_slots.size();
+  }
+
   auto begin() {
     return this->entries.begin();
   }
@@ -0,0 +1,84 @@
+#ifndef RECORDING_H
+#define RECORDING_H
+#include <core.h>
+#include <simulation.h>
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Session recording. Every command the sim side processes is logged with
+// the number of ticks completed before it; together with the starting
+// world that is enough to rerun the session tick for tick, headless.
+namespace runner {
+
+// Defined in runner.h
+enum class CommandKind;
+enum class Speed;
+struct Command;
+
+// How the recorded session got its starting world
+enum class RecordingStart : u32 {
+  Scenario,
+  Save,
+};
+
+struct RecordedCommand {
+  // Ticks completed when the command was processed
+  u64 tick{0};
+  CommandKind kind;
+  Speed speed;
+  // Entities are stored as pool slots, not pointers
+  simulation::EntityIdKind id_kind{simulation::EntityIdKind::INVALID};
+  u32 id_slot{0};
+  u64 id_generation{0};
+};
+
+struct Recording {
+  RecordingStart start{RecordingStart::Scenario};
+  u64 seed{0};
+  // Save the session started from, when `start` is Save
+  std::string load_path;
+  u32 num_threads{0};
+  std::vector<RecordedCommand> commands;
+  // Whole state digest after each tick, from tick 1; empty if the session
+  // was recorded without
+  std::vector<u64> digests;
+  // Ticks the session ran. If it did not end cleanly, the last tick the log
+  // got to.
+  u64 ticks{0};
+  bool complete{false};
+};
+
+class Recorder {
+private:
+  FILE* file{nullptr};
+
+public:
+  Recorder() = default;
+  Recorder(const Recorder& other) = delete;
+  ~Recorder();
+
+  // Call once the starting world is in place. `load_path` is the save it
+  // was loaded from, or null for the built-in scenario.
+  bool Open(const char* path, const simulation::Sim& sim, const char* load_path);
+
+  // No-op unless open
+  void Record(const simulation::Sim& sim, u64 tick, const Command& command);
+
+  // Digest of the state after `tick`. Digests are optional, but when
+  // present there must be one for every tick.
+  void RecordDigest(u64 tick, u64 digest);
+
+  // Marks the end of the session and closes the log
+  void Close(u64 ticks);
+};
+
+bool ReadRecording(const char* path, Recording& recording);
+
+// Handle to the recorded entity in `sim`; stale if it no longer exists there
+simulation::EntityId ToEntityId(
+    const simulation::Sim& sim, const RecordedCommand& command);
+
+} // namespace runner
+#endif
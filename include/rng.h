@@ -0,0 +1,88 @@
+#ifndef RNG_H
+#define RNG_H
+#include <core.h>
+
+#include <array>
+
+// Counter-based random numbers (Philox4x32-10). A generator is a pure
+// function of its key and counter, so draws depend only on what they are
+// keyed on and never on which thread runs first.
+namespace rng {
+
+// Independent sequences for the same entity and tick
+enum class Stream : u32 {
+  PopGrowth,
+};
+
+class Philox {
+private:
+  static constexpr u32 M0 = 0xD2511F53;
+  static constexpr u32 M1 = 0xCD9E8D57;
+  static constexpr u32 W0 = 0x9E3779B9;
+  static constexpr u32 W1 = 0xBB67AE85;
+  static constexpr u32 ROUNDS = 10;
+
+  std::array<u32, 4> counter;
+  std::array<u32, 2> key;
+  std::array<u32, 4> block;
+  u32 used{4};
+
+  static inline u32 MulHi(u32 a, u32 b, u32& lo) {
+    u64 product = u64(a) * u64(b);
+    lo = u32(product);
+    return u32(product >> 32);
+  }
+
+  void Generate() {
+    auto x = this->counter;
+    auto k = this->key;
+    for (u32 round = 0; round < ROUNDS; ++round) {
+      u32 lo0, lo1;
+      u32 hi0 = MulHi(M0, x[0], lo0);
+      u32 hi1 = MulHi(M1, x[2], lo1);
+      x = {hi1 ^ x[1] ^ k[0], lo1, hi0 ^ x[3] ^ k[1], lo0};
+      k[0] += W0;
+      k[1] += W1;
+    }
+    this->block = x;
+    this->used = 0;
+    // Only the draw index moves; the rest of the counter is the identity
+    this->counter[0]++;
+  }
+
+public:
+  // counter = (draw, stream, entity low, entity high); the tick is folded
+  // into the key
+  Philox(u64 seed, u64 tick, u64 entity, Stream stream) {
+    u64 mixed = seed ^ (tick * 0x9E3779B97F4A7C15ull);
+    this->key = {u32(mixed), u32(mixed >> 32)};
+    this->counter = {0, u32(stream), u32(entity), u32(entity >> 32)};
+  }
+
+  u32 NextU32() {
+    if (this->used == 4) {
+      this->Generate();
+    }
+    return this->block[this->used++];
+  }
+
+  // Uniform in [0, 1)
+  f64 NextF64() {
+    u64 bits = (u64(this->NextU32()) << 32) | this->NextU32();
+    return f64(bits >> 11) * 0x1.0p-53;
+  }
+
+  // Uniform in [lo, hi)
+  f64 Uniform(f64 lo, f64 hi) { return lo + (hi - lo) * this->NextF64(); }
+
+  bool Chance(f64 probability) { return this->NextF64() < probability; }
+};
+
+// Entity part of the key: slot plus generation, so a reused slot gets a
+// fresh sequence
+static inline u64 EntityKey(u64 slot, u64 generation) {
+  return (generation << 32) ^ slot;
+}
+
+} // namespace rng
+#endif
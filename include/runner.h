@@ -0,0 +1,179 @@
+#ifndef RUNNER_H
+#define RUNNER_H
+#include <arena.h>
+#include <autosave.h>
+#include <concurrent.h>
+#include <digest.h>
+#include <history.h>
+#include <recording.h>
+#include <simulation.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+// Runs the simulation on its own thread. The UI talks to it only through a
+// command queue in one direction and published snapshots in the other.
+// On machines with few cores it can instead run inline, advancing the sim in
+// time-budgeted slices from the UI loop.
+namespace runner {
+
+using Clock = std::chrono::steady_clock;
+
+enum class Speed {
+  Paused,
+  X1,
+  X2,
+  X5,
+  Max,
+};
+
+// Ticks per second at 1x
+static const f64 BASE_TICK_RATE = 2.0;
+
+// Ticks per second for a speed setting. Zero for paused, and for max, which
+// is not rate limited at all.
+static inline f64 TickRate(Speed speed) {
+  switch (speed) {
+  case Speed::X1:
+    return BASE_TICK_RATE;
+  case Speed::X2:
+    return BASE_TICK_RATE * 2.0;
+  case Speed::X5:
+    return BASE_TICK_RATE * 5.0;
+  case Speed::Paused:
+  case Speed::Max:
+    break;
+  }
+  return 0.0;
+}
+
+enum class CommandKind {
+  AdvanceDay,
+  Select,
+  SetSpeed,
+  // Writes the sim to Options::save_path at the next tick boundary
+  Save,
+};
+
+struct Command {
+  CommandKind kind{CommandKind::AdvanceDay};
+  simulation::EntityId id;
+  Speed speed{Speed::Paused};
+};
+
+struct Stats {
+  u64 ticks{0};
+  f64 last_tick_ms{0.0};
+  // Achieved rate, averaged over the last measurement window
+  f64 ticks_per_second{0.0};
+  u64 autosaves{0};
+  u64 failed_autosaves{0};
+};
+
+// Read-only view of the simulation, built on the sim thread after a tick.
+// Everything it points to lives in its own arena.
+struct Snapshot {
+  arena::Arena arena;
+  // Counts publishes, so readers can tell a new snapshot from the last one
+  u64 sequence{0};
+  // Changes whenever some location changes owner
+  u64 owners_version{0};
+  simulation::Date date;
+  arena::List<simulation::MapItem> map_items;
+  // Selection as last seen by the sim thread. `selected` is null when the
+  // entity no longer exists.
+  simulation::EntityId selected_id;
+  simulation::Object* selected{nullptr};
+  // Population of the selected location: recent days, then monthly means
+  std::vector<f32> population_daily;
+  std::vector<f32> population_monthly;
+  Speed speed{Speed::Paused};
+  Stats stats;
+};
+
+struct Options {
+  // Tick on a dedicated thread. When false, Frame() advances the sim.
+  bool threaded{true};
+  // Time each Frame() may spend ticking in inline mode
+  f64 frame_budget_ms{4.0};
+  // Save to start from instead of the built-in scenario
+  const char* load_path{nullptr};
+  const char* save_path{"save.bin"};
+  // Background save every this many days; 0 turns autosave off
+  u64 autosave_days{0};
+  const char* autosave_path{"autosave.bin"};
+  // Autosaves after the first write only what changed, as deltas on a base;
+  // a new base is written every this many deltas
+  u64 autosave_compact_every{11};
+  // Log of every command processed, for replaying the session headless.
+  // Also logs a state digest after every tick, for the replay to check.
+  const char* record_path{nullptr};
+};
+
+class Runner {
+private:
+  Options options;
+  simulation::Sim sim;
+  concurrent::SpscQueue<Command, 256> commands;
+  // Bumped on every push, so the sim thread can sleep while idle
+  std::atomic<u64> num_pushed{0};
+  concurrent::TripleBuffer<Snapshot> snapshots;
+  std::thread thread;
+  std::atomic<bool> quit{false};
+
+  // Sim side state
+  simulation::EntityId selected_id;
+  Speed speed{Speed::Paused};
+  Stats stats;
+  // Ticks asked for by the player, and ticks due from the speed setting
+  u64 requested_ticks{0};
+  u64 due_ticks{0};
+  // Set when something happened that the last snapshot does not show yet
+  bool changed{false};
+  Clock::time_point next_tick;
+  Clock::time_point last_publish;
+  Clock::time_point window_start;
+  u64 window_ticks{0};
+  // Time spent so far on the sliced tick in progress
+  f64 slice_ms{0.0};
+  bool save_pending{false};
+  u64 num_published{0};
+  simulation::Autosave autosave;
+  simulation::SaveChain autosave_chain{0};
+  Recorder recorder;
+  simulation::StateHasher hasher;
+  simulation::History history;
+
+  void ProcessCommands();
+  void ScheduleTicks(Clock::time_point now);
+  void FinishTick(f64 elapsed_ms);
+  void SaveIfPending();
+  void PollAutosave();
+  void UpdateRate(Clock::time_point now);
+  void MaybePublish(Clock::time_point now);
+  void Publish();
+  void Main();
+
+public:
+  Runner() = default;
+  Runner(const Runner& other) = delete;
+
+  void Start(Options options = {});
+  void Stop();
+
+  // UI thread, once per frame. Only does work in inline mode, where it ticks
+  // until the frame budget is spent. A sliced tick is published only once
+  // it completes.
+  void Frame();
+
+  // UI thread. Returns false if the queue is full.
+  bool Push(Command command);
+
+  // UI thread. Latest published snapshot; valid until the next call.
+  const Snapshot& Acquire() { return this->snapshots.Acquire(); }
+};
+
+} // namespace runner
+#endif
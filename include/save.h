@@ -0,0 +1,74 @@
+#ifndef SAVE_H
+#define SAVE_H
+#include <core.h>
+
+namespace simulation {
+
+struct Sim;
+
+// Binary snapshot of the whole simulation state. Every pool is written as
+// one block of records with pointers swapped for slot indices; loading maps
+// the file and copies the blocks back, then fixes the pointers up in place.
+// Derived state (trade flows, path tables) is rebuilt on the next tick.
+//
+// Saves are only valid for a build with the same definitions and record
+// layouts; the header carries a version that must match.
+
+// Writes at a tick boundary. Errors are reported on stdout.
+bool SaveSim(const Sim& sim, const char* path);
+
+// Change period each pool had reached at a save, see Pool::Checkpoint
+struct ChangeMarks {
+  u32 pops{0};
+  u32 buildings{0};
+  u32 locations{0};
+  u32 countries{0};
+};
+
+// What one save writes. The default is a standalone full save.
+struct SavePlan {
+  // Full snapshot, or only the entities touched after `since`
+  bool base{true};
+  // Ties deltas to their base; 0 for standalone saves
+  u64 chain_id{0};
+  // Position of a delta in its chain, from 1. Delta N of `path` is written
+  // to `path.N`.
+  u64 sequence{0};
+  ChangeMarks since;
+  // Deltas of the previous chain to delete once a new base is in place
+  u64 stale_deltas{0};
+};
+
+// Plans a base snapshot followed by deltas, each holding only what changed
+// since the save before it. Every `compact_every` deltas the chain is
+// folded into a new base.
+class SaveChain {
+private:
+  u64 compact_every{0};
+  u64 chain_id{0};
+  u64 num_deltas{0};
+  ChangeMarks marks;
+
+public:
+  explicit SaveChain(u64 compact_every) : compact_every(compact_every) {}
+
+  // Starts a new change period in every pool. Call at a tick boundary, and
+  // pass the plan to the save that runs now.
+  SavePlan Next(Sim& sim);
+
+  // Called after a failed save: the next one is a base
+  void Reset();
+};
+
+// Same format, deflated in chunks and renamed into place once complete.
+// Slower to write; meant for background saves.
+bool SaveSimCompressed(const Sim& sim, const char* path, const SavePlan& plan = {});
+
+// Reads plain and compressed saves, then replays any deltas that continue
+// the base. `sim` must come straight from InitEmpty. If the base cannot be
+// loaded it is left untouched; a broken delta stops the replay at the one
+// before it.
+bool LoadSim(Sim& sim, const char* path);
+
+} // namespace simulation
+#endif
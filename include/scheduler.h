@@ -0,0 +1,118 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+#include <core.h>
+
+#include <chrono>
+#include <initializer_list>
+#include <vector>
+
+namespace simulation {
+
+struct Sim;
+struct TickRequest;
+
+// Pieces of simulation state a system can declare it touches.
+enum class Resource : u32 {
+  Date,
+  Pops,
+  Buildings,
+  Locations,
+  Countries,
+  Events,
+  Network,
+  Markets,
+  Trade,
+  COUNT,
+};
+
+// Bit set of resources
+struct Access {
+  u64 bits{0};
+
+  Access() = default;
+  Access(std::initializer_list<Resource> resources) {
+    for (auto resource : resources) {
+      this->bits |= u64(1) << u64(resource);
+    }
+  }
+
+  bool Overlaps(Access other) const { return (this->bits & other.bits) != 0; }
+};
+
+// Half-open range of items (usually pool slots) a system call covers
+struct Range {
+  usize begin{0};
+  usize end{0};
+};
+
+using SystemFn = void (*)(Sim& sim, const TickRequest& request, Range range);
+using CountFn = usize (*)(const Sim& sim);
+
+// A system either runs as a single call, or, when it has a `count`, over
+// items [0, count) split in chunks. Chunks of one system may run
+// concurrently or be spread over several frames, so a chunked system must
+// only write state owned by the items in its range. Pool layout is stable
+// during a tick, since structural changes are deferred to its end.
+//
+// A system with a `period` of N days only needs to see each item once every
+// N days. Its items are spread over N buckets, one processed per day as
+// picked by the date, so the cost is smoothed over the period. A single-call
+// system with a period runs on every Nth day.
+struct System {
+  const char* name{""};
+  Access reads;
+  Access writes;
+  SystemFn run{nullptr};
+  CountFn count{nullptr};
+  usize chunk_size{256};
+  u64 period{1};
+};
+
+// Two systems conflict when either one writes something the other touches.
+static inline bool Conflicts(const System& a, const System& b) {
+  return a.writes.Overlaps(b.reads) || a.writes.Overlaps(b.writes) ||
+         b.writes.Overlaps(a.reads);
+}
+
+// Runs registered systems once per tick. Systems that do not conflict run
+// concurrently; conflicting ones keep their registration order.
+class Scheduler {
+private:
+  std::vector<System> systems;
+  // Per-tick scratch: systems grouped in waves that can run concurrently
+  std::vector<std::vector<usize>> waves;
+  std::vector<usize> wave_of;
+  // Items each system processes this tick, fixed when the tick starts
+  std::vector<Range> ranges;
+
+  // Position of a sliced tick
+  struct Cursor {
+    bool active{false};
+    usize wave{0};
+    usize slot{0};
+    usize item{0};
+  };
+  Cursor cursor;
+
+  void BuildWaves(const Sim& sim);
+
+public:
+  using Clock = std::chrono::steady_clock;
+
+  void Register(System system);
+
+  usize NumSystems() const { return this->systems.size(); }
+
+  // Runs a whole tick, spreading work over the worker pool
+  void Run(Sim& sim, const TickRequest& request);
+
+  // Sliced tick on the calling thread: Begin, then call Step with the same
+  // request until it returns true. Each Step runs chunks until `deadline`
+  // passes, always making progress by at least one chunk.
+  void Begin(const Sim& sim);
+  bool Step(Sim& sim, const TickRequest& request, Clock::time_point deadline);
+  bool InProgress() const { return this->cursor.active; }
+};
+
+} // namespace simulation
+#endif
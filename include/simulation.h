@@ -1,7 +1,14 @@
 #ifndef SIMULATION_H
 #define SIMULATION_H
+#include <aggregates.h>
 #include <arena.h>
+#include <commands.h>
+#include <ledger.h>
+#include <paths.h>
 #include <pool.h>
+#include <scheduler.h>
+#include <timers.h>
+#include <trade.h>
 
 #include <sstream>
 #include <vector>
@@ -14,10 +21,14 @@ using namespace arena;
 
 template <typename T> using unique_vector = std::unique_ptr<std::vector<T>>;
 
+// One epoch step is one day
 struct Date {
   u64 epoch{0};
 };
 
+static const u64 DAYS_PER_MONTH = 30;
+static const u64 DAYS_PER_YEAR = 360;
+
 template <typename T, typename V> class Vector {
   std::vector<V> entries;
 
@@ -32,6 +43,8 @@ public:
     this->entries.resize(definition.size(), {});
   }
 
+  usize Size() const { return this->entries.size(); }
+
   V& operator[](T::Id id) { return (*this)[id.idx]; }
 
   const V& operator[](T::Id id) const { return (*this)[id.idx]; }
@@ -68,6 +81,10 @@ struct PopType {
   std::string tag;
   std::string name;
   NumVector<GoodType> demand;
+  // Yearly growth rate
+  f64 growth{0.0};
+  // Each pop's monthly rate is drawn within growth * (1 +- spread)
+  f64 growth_spread{0.0};
 };
 
 using PopTypes = std::vector<PopType>;
@@ -92,12 +109,19 @@ struct Pop {
   u64 generation{0};
   const PopType* type{nullptr};
   i64 size{0};
+  // Fractional growth not yet added to size
+  f64 growth_carry{0.0};
+  Money money{0};
 
   // Location of pop
   Location* location{nullptr};
 
   // Pop at location linked list
   Pop* location_chain_next{nullptr};
+
+  // Set when the pop was merged into another one, see Resolve
+  Pop* merged_into{nullptr};
+  u64 merged_into_generation{0};
 };
 
 using Pops = Pool<Pop>;
@@ -106,6 +130,7 @@ struct Building {
   u64 generation{0};
   const BuildingType* type{nullptr};
   i64 size{0};
+  Money money{0};
 
   // Location of pop
   Location* location{nullptr};
@@ -128,6 +153,8 @@ struct Location {
   unique_vector<Pop*> pops_at_location{nullptr};
   unique_vector<Building*> buildings_at_location{nullptr};
   Country* owner_country{nullptr};
+  // Position in the owner's owned_locations
+  u32 owned_index{0};
 };
 
 using Locations = Pool<Location>;
@@ -144,6 +171,7 @@ struct Country {
   const char* name{DEFAULT_STRING};
   RGB color;
   unique_vector<Location*> owned_locations{nullptr};
+  Money money{0};
 };
 
 using Countries = Pool<Country>;
@@ -154,33 +182,22 @@ struct Player {
   Country* country{nullptr};
 };
 
-struct Sim {
-  Date date;
-  // Common semi-static data
-  GoodTypes good_types;
-  PopTypes pop_types;
-  BuildingTypes building_types;
-  Strings strings;
-  // Entity Pools
-  Pops pops;
-  Buildings buildings;
-  Locations locations;
-  Countries countries;
-  // Player information
-  Player player;
-};
-
-struct TickRequest {
-  bool advance_time{false};
-};
-
-void Init(Sim& sim);
-
-void Tick(Sim& sim, const TickRequest& req);
+// Live entities have an odd generation
+static inline bool IsValid(const Pop& pop) { return pop.generation % 2 == 1; }
+static inline bool IsValid(const Building& building) {
+  return building.generation % 2 == 1;
+}
+static inline bool IsValid(const Location& location) {
+  return location.generation % 2 == 1;
+}
+static inline bool IsValid(const Country& country) {
+  return country.generation % 2 == 1;
+}
 
 enum class EntityIdKind {
   Location,
   Building,
+  Pop,
   INVALID,
 };
 
@@ -213,6 +230,10 @@ struct EntityId {
         break;
       case simulation::EntityIdKind::Building:
         generation = GenerationOf<Building>();
+        break;
+      case EntityIdKind::Pop:
+        generation = GenerationOf<Pop>();
+        break;
       case EntityIdKind::INVALID:
         break;
     }
@@ -222,12 +243,161 @@ struct EntityId {
   bool operator==(const EntityId& other) const = default;
 };
 
+static inline EntityId IdOf(const Location& location) {
+  return {EntityIdKind::Location, &location, location.generation};
+}
+
+static inline EntityId IdOf(const Building& building) {
+  return {EntityIdKind::Building, &building, building.generation};
+}
+
+static inline EntityId IdOf(const Pop& pop) {
+  return {EntityIdKind::Pop, &pop, pop.generation};
+}
+
+// Follows pop merges: a handle to a pop that was merged away resolves to the
+// pop that absorbed it, as long as its slot has not been reused since.
+// Other stale handles resolve to Null.
+static inline EntityId Resolve(EntityId id) {
+  while (!id.IsValid()) {
+    if (id.kind != EntityIdKind::Pop || !id.handle) {
+      return EntityId::Null();
+    }
+    const auto* pop = (const Pop*)id.handle;
+    if (pop->generation != id.generation + 1 || !pop->merged_into) {
+      return EntityId::Null();
+    }
+    id = {EntityIdKind::Pop, pop->merged_into, pop->merged_into_generation};
+  }
+  return id;
+}
+
+enum class EventKind {
+  // Grows the target building by `amount`
+  BuildingComplete,
+  // Moves the target pop to `destination`
+  PopMigrate,
+};
+
+// Future-dated simulation event. Dropped when it fires if its target no
+// longer exists.
+struct Event {
+  EventKind kind{EventKind::BuildingComplete};
+  EntityId target;
+  // Location a PopMigrate moves to, dropped too if gone by then
+  EntityId destination;
+  i64 amount{0};
+};
+
+using Events = TimingWheel<Event>;
+
+struct Sim {
+  Date date;
+  // Keys every random draw, together with the day and the entity
+  u64 seed{1};
+  // Common semi-static data
+  GoodTypes good_types;
+  PopTypes pop_types;
+  BuildingTypes building_types;
+  Strings strings;
+  // Entity Pools
+  Pops pops;
+  Buildings buildings;
+  Locations locations;
+  Countries countries;
+  // Player information
+  Player player;
+  // Systems run every tick
+  Scheduler systems;
+  // Structural changes deferred to the end of the tick
+  Commands commands;
+  // Future-dated events
+  Events events;
+  // Connections and goods flows between locations
+  LocationGraph location_graph;
+  PathService paths;
+  Markets markets;
+  Trade trade;
+  // Money transfers deferred to the end of the tick
+  Ledger ledger;
+  // Location, country and world sums
+  Aggregates aggregates;
+};
+
+static inline Totals TotalsOf(const Pop& pop) {
+  return {.population = pop.size};
+}
+
+static inline Totals TotalsOf(const Building& building) {
+  f64 output = 0.0;
+  for (usize good = 0; good < building.type->output.Size(); ++good) {
+    output += building.type->output[good];
+  }
+  return {.buildings = building.size, .output = output * building.size};
+}
+
+static inline Totals Negate(Totals totals) {
+  Totals result;
+  result -= totals;
+  return result;
+}
+
+static inline Account AccountOf(const Sim& sim, const Country& country) {
+  return {AccountKind::Country, u32(sim.countries.IndexOf(country))};
+}
+
+static inline Account AccountOf(const Sim& sim, const Pop& pop) {
+  return {AccountKind::Pop, u32(sim.pops.IndexOf(pop))};
+}
+
+static inline Account AccountOf(const Sim& sim, const Building& building) {
+  return {AccountKind::Building, u32(sim.buildings.IndexOf(building))};
+}
+
+static inline Account WorldAccount() { return {AccountKind::World, 0}; }
+
+struct TickRequest {
+  bool advance_time{false};
+};
+
+void Init(Sim& sim);
+
+// The two halves of Init: definitions, pools and systems, then the starting
+// world. Loading a save goes through InitEmpty alone.
+void InitEmpty(Sim& sim);
+void InitScenario(Sim& sim);
+
+void Tick(Sim& sim, const TickRequest& req);
+
+// Schedules an event `days` from today
+TimerHandle ScheduleEvent(Sim& sim, u64 days, Event event);
+bool CancelEvent(Sim& sim, TimerHandle handle);
+
+// Moves a location to another country, or to none, in O(1). Aggregates
+// follow in the same call; map colors are read from the owner.
+void ChangeLocationOwner(Sim& sim, Country* country, Location* location);
+
+// Moves every location of `from` to `to`, in O(locations moved)
+void TransferAll(Sim& sim, Country& from, Country& to);
+
+// Changes the transport cost between two connected locations, keeping the
+// path tables up to date. Call between ticks.
+void SetConnectionCost(Sim& sim, Location& a, Location& b, f64 cost);
+
+// Frame-budgeted alternative to Tick. Runs the tick in chunks until
+// `deadline`, picking up where the previous call stopped. Returns true once
+// the whole tick, including deferred commands, has been applied.
+bool TickSlice(
+    Sim& sim, const TickRequest& req, Scheduler::Clock::time_point deadline);
+
 struct MapItem {
   EntityId id;
   const char* name{""};
   V2 coords;
   f32 size{0.0};
   RGB color;
+  // Owner's country slot, Aggregates::NIL when unowned
+  u32 owner{Aggregates::NIL};
 };
 
 arena::List<MapItem> ViewMapItems(const Sim& sim, arena::Arena& arena);
@@ -239,6 +409,11 @@ enum class Field {
   Pops,
   Buildings,
   Country,
+  Population,
+  Output,
+  Gdp,
+  CountryPopulation,
+  CountryGdp,
 };
 
 template <typename T>
@@ -0,0 +1,73 @@
+#ifndef SPAWN_H
+#define SPAWN_H
+#include <core.h>
+
+#include <limits>
+#include <string_view>
+#include <vector>
+
+namespace simulation {
+
+struct Sim;
+
+static const u32 NOT_FOUND = std::numeric_limits<u32>::max();
+
+// Resolves a tag once, so batches can refer to types and locations by index.
+// NOT_FOUND when there is no such tag.
+u32 FindPopType(const Sim& sim, std::string_view tag);
+u32 FindLocation(const Sim& sim, std::string_view tag);
+
+// Pops to create, one row per pop, stored column by column. Types are
+// indices into Sim::pop_types and locations are location pool slots.
+struct PopBatch {
+  std::vector<u32> types;
+  std::vector<u32> locations;
+  std::vector<i64> sizes;
+
+  void Reserve(usize count) {
+    this->types.reserve(count);
+    this->locations.reserve(count);
+    this->sizes.reserve(count);
+  }
+
+  void Push(u32 type, u32 location, i64 size) {
+    this->types.push_back(type);
+    this->locations.push_back(location);
+    this->sizes.push_back(size);
+  }
+
+  usize Size() const { return this->types.size(); }
+};
+
+enum class SpawnErrorKind {
+  InvalidType,
+  InvalidLocation,
+  InvalidSize,
+  OutOfSpace,
+};
+
+struct SpawnError {
+  usize row{0};
+  SpawnErrorKind kind{SpawnErrorKind::InvalidType};
+};
+
+struct SpawnResult {
+  // Rows applied, whether they made a new pop or joined an existing one
+  usize spawned{0};
+  // New pops
+  usize created{0};
+  // Sorted by row. Rows with an error are skipped; the rest are spawned.
+  std::vector<SpawnError> errors;
+};
+
+const char* ToString(SpawnErrorKind kind);
+
+// Creates every valid row of the batch in one pass. Rows merge into the pop
+// of the same type at their location, existing or new, so a location never
+// gets a second pop of a type. Pool slots are taken up front, location lists
+// grow once per location, and the work runs in parallel unless `parallel`
+// is false. Call between ticks.
+SpawnResult SpawnPops(Sim& sim, const PopBatch& batch, bool parallel = true);
+
+} // namespace simulation
+#endif
@@ -0,0 +1,110 @@
+#ifndef STATS_EXPORT_H
+#define STATS_EXPORT_H
+#include <core.h>
+
+#include <condition_variable>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Per-tick statistics streamed to disk for offline analysis.
+//
+// The file is columnar. A header lists the columns, each a fixed number of
+// 8-byte values per tick: a market price per (location, good), a population
+// per location, and so on. Then come blocks of consecutive ticks, and each
+// block stores every column as its own chunk. Before a chunk is deflated,
+// each row is XORed with the row before it in the block, so values that
+// barely move compress to almost nothing.
+//
+// The sim thread only copies values into the block being filled. A writer
+// thread encodes and writes full blocks. There are two blocks, and if the
+// writer still has the other one when the filling block is full, Append
+// waits for it.
+// Deflate state, see external/sdefl.h
+struct sdefl;
+
+namespace simulation {
+
+struct Sim;
+
+enum class StatsKind : u32 {
+  U64,
+  I64,
+  F64,
+};
+
+struct StatsColumn {
+  std::string name;
+  StatsKind kind{StatsKind::F64};
+  // Values per tick
+  usize width{0};
+};
+
+struct StatsExportStats {
+  u64 ticks{0};
+  u64 blocks{0};
+  u64 raw_bytes{0};
+  u64 written_bytes{0};
+  // Appends that had to wait for the writer
+  u64 stalls{0};
+};
+
+class StatsExport {
+private:
+  struct Block {
+    u64 first_tick{0};
+    usize num_rows{0};
+    // One buffer per column, rows of that column's width
+    std::vector<std::vector<u64>> columns;
+  };
+
+  std::vector<StatsColumn> columns;
+  usize rows_per_block{0};
+  FILE* file{nullptr};
+
+  // `filling` belongs to the sim thread; `full`, when set, to the writer
+  Block blocks[2];
+  Block* filling{nullptr};
+  Block* full{nullptr};
+  std::mutex mutex;
+  std::condition_variable changed;
+  bool quit{false};
+  bool failed{false};
+  std::thread writer;
+  StatsExportStats stats;
+
+  void Hand(std::unique_lock<std::mutex>& lock, Block* block);
+  void WriterMain();
+  bool WriteBlock(Block& block, std::vector<u64>& delta, std::vector<byte>& packed,
+      sdefl* state);
+
+public:
+  StatsExport() = default;
+  StatsExport(const StatsExport& other) = delete;
+  ~StatsExport();
+
+  // Starts the writer thread. Columns are laid out for the sim as it is
+  // now; their widths must not change while the export is open.
+  bool Open(const char* path, const Sim& sim, usize rows_per_block = 64);
+
+  // Sim thread, once after every tick. No-op unless open.
+  void Append(const Sim& sim);
+
+  // Writes the partial block, stops the writer and closes the file. False if
+  // any write failed.
+  bool Close();
+
+  bool IsOpen() const { return this->file != nullptr; }
+  StatsExportStats Stats();
+};
+
+// Reads one column back whole, rows of `width` values one after the other.
+// For tools and checks; a long export is better read block by block.
+bool ReadStatsColumn(const char* path, const char* name, StatsColumn& column,
+    std::vector<u64>& values);
+
+} // namespace simulation
+#endif
@@ -0,0 +1,263 @@
+#ifndef TIMERS_H
+#define TIMERS_H
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cassert>
+#include <limits>
+#include <vector>
+#include <core.h>
+
+// Handle to a scheduled timer. Stays safe to use after the timer fired or
+// was cancelled: the slot generation no longer matches and it is ignored.
+struct TimerHandle {
+  u32 index{std::numeric_limits<u32>::max()};
+  u32 generation{0};
+};
+
+// Hierarchical timing wheel keyed on whole days. Schedule and Cancel are
+// O(1); Advance costs O(1) per day plus the events it fires, with an
+// occasional cascade that moves events down one level. Timers due on the
+// same day fire in the order they were scheduled.
+template <typename T> class TimingWheel {
+private:
+  static constexpr u32 BITS = 6;
+  static constexpr u32 SLOTS = 1 << BITS;
+  static constexpr u32 MASK = SLOTS - 1;
+  static constexpr u32 LEVELS = 4;
+  static constexpr u32 NIL = std::numeric_limits<u32>::max();
+  // Lists past the wheel itself: one for far-future timers, one for timers
+  // already due, and one for timers being fired, in order
+  static constexpr u32 OVERFLOW_LIST = LEVELS * SLOTS;
+  static constexpr u32 READY_LIST = OVERFLOW_LIST + 1;
+  static constexpr u32 FIRING_LIST = READY_LIST + 1;
+  static constexpr u32 NUM_LISTS = FIRING_LIST + 1;
+
+  struct Node {
+    T payload;
+    u64 due{0};
+    // Order of scheduling
+    u64 sequence{0};
+    u32 generation{0};
+    u32 list{NIL};
+    u32 prev{NIL};
+    u32 next{NIL};
+  };
+
+  std::vector<Node> nodes;
+  std::vector<u32> free_list;
+  std::array<u32, NUM_LISTS> heads;
+  // Last day processed
+  u64 now{0};
+  usize num_pending{0};
+  u64 next_sequence{0};
+  // Scratch for sorting timers that are due
+  std::vector<u32> due;
+
+  void Link(u32 idx, u32 list) {
+    auto& node = this->nodes[idx];
+    node.list = list;
+    node.prev = NIL;
+    node.next = this->heads[list];
+    if (node.next != NIL) {
+      this->nodes[node.next].prev = idx;
+    }
+    this->heads[list] = idx;
+  }
+
+  void Unlink(u32 idx) {
+    auto& node = this->nodes[idx];
+    if (node.prev != NIL) {
+      this->nodes[node.prev].next = node.next;
+    } else {
+      this->heads[node.list] = node.next;
+    }
+    if (node.next != NIL) {
+      this->nodes[node.next].prev = node.prev;
+    }
+    node.list = NIL;
+    node.prev = NIL;
+    node.next = NIL;
+  }
+
+  // The level is picked by the highest 6-bit group in which `due` and `now`
+  // differ, so a timer is only looked at again when the wheel reaches the
+  // start of its group.
+  void Place(u32 idx) {
+    u64 due = this->nodes[idx].due;
+    if (due <= this->now) {
+      this->Link(idx, READY_LIST);
+      return;
+    }
+    u32 level = (std::bit_width(due ^ this->now) - 1) / BITS;
+    if (level >= LEVELS) {
+      this->Link(idx, OVERFLOW_LIST);
+      return;
+    }
+    u32 slot = (due >> (level * BITS)) & MASK;
+    this->Link(idx, level * SLOTS + slot);
+  }
+
+  // Re-places every timer of a list against the current day
+  void Cascade(u32 list) {
+    u32 idx = this->heads[list];
+    this->heads[list] = NIL;
+    while (idx != NIL) {
+      u32 next = this->nodes[idx].next;
+      this->nodes[idx].list = NIL;
+      this->Place(idx);
+      idx = next;
+    }
+  }
+
+  // Appends the timers of a list to `due` and empties it
+  void Collect(u32 list) {
+    for (u32 idx = this->heads[list]; idx != NIL; idx = this->nodes[idx].next) {
+      this->due.push_back(idx);
+    }
+    this->heads[list] = NIL;
+  }
+
+  // Fires the timers of `list` and every timer already due, oldest first,
+  // including those the callbacks schedule for today
+  template <typename F> void FireDue(u32 list, F& fire) {
+    this->Collect(list);
+    this->Collect(READY_LIST);
+    while (!this->due.empty()) {
+      std::sort(this->due.begin(), this->due.end(), [&](u32 a, u32 b) {
+        return this->nodes[a].sequence < this->nodes[b].sequence;
+      });
+      // Link puts a timer first, so the newest goes in first
+      for (auto it = this->due.rbegin(); it != this->due.rend(); ++it) {
+        this->Link(*it, FIRING_LIST);
+      }
+      this->due.clear();
+      this->FireList(FIRING_LIST, fire);
+      this->Collect(READY_LIST);
+    }
+  }
+
+  template <typename F> void FireList(u32 list, F& fire) {
+    while (this->heads[list] != NIL) {
+      u32 idx = this->heads[list];
+      this->Unlink(idx);
+      auto& node = this->nodes[idx];
+      node.generation++;
+      // Moved out first: fire may schedule and reuse the slot
+      T payload = std::move(node.payload);
+      this->free_list.push_back(idx);
+      this->num_pending--;
+      fire(payload);
+    }
+  }
+
+public:
+  TimingWheel() { this->heads.fill(NIL); }
+
+  void Reset(u64 now) {
+    this->nodes.clear();
+    this->free_list.clear();
+    this->heads.fill(NIL);
+    this->now = now;
+    this->num_pending = 0;
+    this->next_sequence = 0;
+  }
+
+  u64 Now() const { return this->now; }
+
+  // Calls fn(due, payload) for every pending timer, in slot order
+  template <typename F> void ForEachPending(F fn) const {
+    for (const auto& node : this->nodes) {
+      if (node.list != NIL) {
+        fn(node.due, node.payload);
+      }
+    }
+  }
+  // Calls fn(due, payload) for every pending timer, in the order they were
+  // scheduled. Scheduling them again in this order keeps their firing order.
+  template <typename F> void ForEachPendingInOrder(F fn) const {
+    std::vector<u32> order;
+    order.reserve(this->num_pending);
+    for (u32 idx = 0; idx < this->nodes.size(); ++idx) {
+      if (this->nodes[idx].list != NIL) {
+        order.push_back(idx);
+      }
+    }
+    std::sort(order.begin(), order.end(), [&](u32 a, u32 b) {
+      return this->nodes[a].sequence < this->nodes[b].sequence;
+    });
+    for (u32 idx : order) {
+      fn(this->nodes[idx].due, this->nodes[idx].payload);
+    }
+  }
+
+  // Same as ForEachPending, with the payload writable in place; the due day
+  // stays as it is
+  template <typename F> void ForEachPending(F fn) {
+    for (auto& node : this->nodes) {
+      if (node.list != NIL) {
+        fn(node.due, node.payload);
+      }
+    }
+  }
+  usize NumPending() const { return this->num_pending; }
+
+  TimerHandle Schedule(u64 due, T payload) {
+    u32 idx;
+    if (this->free_list.empty()) {
+      idx = u32(this->nodes.size());
+      this->nodes.push_back({});
+    } else {
+      idx = this->free_list.back();
+      this->free_list.pop_back();
+    }
+    auto& node = this->nodes[idx];
+    node.payload = std::move(payload);
+    node.due = due;
+    node.sequence = this->next_sequence++;
+    this->Place(idx);
+    this->num_pending++;
+    return {idx, node.generation};
+  }
+
+  // Returns false if the timer already fired or was cancelled
+  bool Cancel(TimerHandle handle) {
+    if (handle.index >= this->nodes.size()) {
+      return false;
+    }
+    auto& node = this->nodes[handle.index];
+    if (node.generation != handle.generation || node.list == NIL) {
+      return false;
+    }
+    this->Unlink(handle.index);
+    node.generation++;
+    this->free_list.push_back(handle.index);
+    this->num_pending--;
+    return true;
+  }
+
+  // Moves the wheel forward to `day`, calling fire(payload) for every timer
+  // due on or before it
+  template <typename F> void Advance(u64 day, F fire) {
+    this->FireDue(READY_LIST, fire);
+    while (this->now < day) {
+      this->now++;
+      // Cascade from the top down whenever a level's group boundary is hit
+      if ((this->now & ((u64(1) << (LEVELS * BITS)) - 1)) == 0) {
+        this->Cascade(OVERFLOW_LIST);
+      }
+      for (u32 level = LEVELS - 1; level > 0; --level) {
+        u64 low_bits = this->now & ((u64(1) << (level * BITS)) - 1);
+        if (low_bits == 0) {
+          u32 slot = (this->now >> (level * BITS)) & MASK;
+          this->Cascade(level * SLOTS + slot);
+        }
+      }
+      // Along with anything cascaded straight to due
+      this->FireDue(this->now & MASK, fire);
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,160 @@
+#ifndef TRADE_H
+#define TRADE_H
+#include <core.h>
+#include <scheduler.h>
+
+#include <limits>
+#include <span>
+#include <vector>
+
+namespace simulation {
+
+struct Sim;
+
+// Undirected connections between locations, stored in CSR form. Nodes are
+// location pool slots.
+class LocationGraph {
+public:
+  static constexpr u32 NIL = std::numeric_limits<u32>::max();
+
+  struct Edge {
+    u32 a{0};
+    u32 b{0};
+    f64 cost{0.0};
+  };
+
+private:
+  // Authoring list; the CSR arrays are rebuilt from it on demand
+  std::vector<Edge> edges;
+  bool dirty{true};
+  usize num_nodes{0};
+
+  std::vector<u32> offsets;
+  std::vector<u32> targets;
+  std::vector<f64> costs;
+  // Index in `edges` of each CSR entry
+  std::vector<u32> edge_of;
+
+  // Connected components, with their members grouped CSR style
+  std::vector<u32> component_of;
+  std::vector<u32> component_offsets;
+  std::vector<u32> component_nodes;
+
+  // Bumped every time the CSR arrays are rebuilt
+  u64 version{0};
+  // Bumped every time an edge cost changes in place
+  u64 cost_version{0};
+
+public:
+  void Connect(u32 a, u32 b, f64 cost) {
+    this->edges.push_back({a, b, cost});
+    this->dirty = true;
+  }
+
+  void Clear() {
+    this->edges.clear();
+    this->dirty = true;
+  }
+
+  // Rebuilds CSR arrays and components if edges changed
+  void Build(usize num_nodes);
+
+  // Changes the cost of edge (a, b) without a rebuild. Returns the old cost,
+  // or a negative value if there is no such edge.
+  f64 SetCost(u32 a, u32 b, f64 cost);
+
+  usize NumNodes() const { return this->num_nodes; }
+  usize NumComponents() const { return this->component_offsets.size() - 1; }
+  u64 Version() const { return this->version; }
+  u64 CostVersion() const { return this->cost_version; }
+  const std::vector<Edge>& Edges() const { return this->edges; }
+
+  std::span<const u32> Targets(u32 node) const {
+    return {this->targets.data() + this->offsets[node],
+        this->targets.data() + this->offsets[node + 1]};
+  }
+
+  std::span<const f64> Costs(u32 node) const {
+    return {this->costs.data() + this->offsets[node],
+        this->costs.data() + this->offsets[node + 1]};
+  }
+
+  u32 ComponentOf(u32 node) const { return this->component_of[node]; }
+
+  std::span<const u32> ComponentNodes(u32 component) const {
+    return {this->component_nodes.data() + this->component_offsets[component],
+        this->component_nodes.data() + this->component_offsets[component + 1]};
+  }
+};
+
+// Per location, per good market state, stored column by column.
+// Entry (location, good) lives at location * num_goods + good.
+struct Markets {
+  usize num_goods{0};
+  std::vector<f64> supply;
+  std::vector<f64> demand;
+  std::vector<f64> imports;
+  std::vector<f64> exports;
+  std::vector<f64> price;
+
+  void Init(usize num_locations, usize num_goods);
+
+  usize At(usize location, usize good) const {
+    return location * this->num_goods + good;
+  }
+
+  f64 Net(usize idx) const { return this->supply[idx] - this->demand[idx]; }
+};
+
+struct TradeFlow {
+  u32 from{0};
+  u32 to{0};
+  f64 amount{0.0};
+  // Transport cost per unit along the route
+  f64 cost{0.0};
+};
+
+// Per-thread working memory of the solver, indexed by location slot
+struct TradeScratch {
+  std::vector<f64> residual;
+  std::vector<f64> dist;
+  std::vector<u32> origin;
+  // Distances of a repair search; infinite outside one
+  std::vector<f64> reach;
+  std::vector<u32> visited;
+};
+
+// Routed goods between markets. Flows are grouped by region, one region per
+// (connected component, good). A market is dirty when its net balance moved
+// by more than `threshold` since it was last routed. A region with dirty
+// markets is repaired around them, with searches bounded in size, and solved
+// in full only when new or once repairs have touched many of its markets.
+struct Trade {
+  // Relative change of a market's net balance that marks its region dirty
+  f64 threshold{0.05};
+  u64 graph_version{0};
+  u64 graph_cost_version{0};
+
+  std::vector<std::vector<TradeFlow>> region_flows;
+  // Markets repaired in each region since its last full solve
+  std::vector<usize> region_repairs;
+  // Net balance of every market as of the last solve of its region
+  std::vector<f64> solved_net;
+
+  std::vector<TradeScratch> scratch;
+
+  // Stats of the last solve
+  usize regions_solved{0};
+  usize regions_repaired{0};
+};
+
+// Daily systems. ComputeMarkets is chunked by location; SolveTrade runs as a
+// single call after it. UpdateNetwork brings the graph and path tables up
+// to date before either.
+void UpdateNetwork(Sim& sim, const TickRequest& request, Range range);
+usize CountMarkets(const Sim& sim);
+void ComputeMarkets(Sim& sim, const TickRequest& request, Range range);
+void SolveTrade(Sim& sim, const TickRequest& request, Range range);
+
+} // namespace simulation
+#endif
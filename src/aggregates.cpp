@@ -0,0 +1,67 @@
+#include <aggregates.h>
+
+#include <algorithm>
+#include <cassert>
+
+#include <jobs.h>
+
+namespace simulation {
+
+void Aggregates::Init(
+    usize num_locations, usize num_countries, usize num_threads) {
+  this->locations.assign(num_locations, {});
+  this->countries.assign(num_countries, {});
+  this->world = {};
+  this->owner.assign(num_locations, NIL);
+  this->owners_version++;
+  this->pending.assign(num_threads, {});
+}
+
+void Aggregates::Add(u32 location, const Totals& delta) {
+  assert(location < this->locations.size());
+  this->locations[location] += delta;
+  if (this->owner[location] != NIL) {
+    this->countries[this->owner[location]] += delta;
+  }
+  this->world += delta;
+}
+
+void Aggregates::SetOwner(u32 location, u32 country) {
+  assert(location < this->locations.size());
+  u32 old_country = this->owner[location];
+  if (old_country == country) {
+    return;
+  }
+  const auto& totals = this->locations[location];
+  if (old_country != NIL) {
+    this->countries[old_country] -= totals;
+  }
+  if (country != NIL) {
+    this->countries[country] += totals;
+  }
+  this->owner[location] = country;
+  this->owners_version++;
+}
+
+void Aggregates::Record(u32 location, const Totals& delta) {
+  usize idx = jobs::ThreadIndex();
+  assert(idx < this->pending.size());
+  this->pending[idx].push_back({location, delta});
+}
+
+// Deltas are applied by location rather than by thread, so the float sums
+// come out the same whatever thread recorded what
+void Aggregates::Flush() {
+  std::vector<std::pair<u32, Totals>> deltas;
+  for (auto& list : this->pending) {
+    deltas.insert(deltas.end(), list.begin(), list.end());
+    list.clear();
+  }
+  std::stable_sort(deltas.begin(), deltas.end(),
+      [](const auto& a, const auto& b) { return a.first < b.first; });
+  for (const auto& [location, delta] : deltas) {
+    this->Add(location, delta);
+  }
+}
+
+} // namespace simulation
@@ -0,0 +1,96 @@
+#include <autosave.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace simulation {
+
+// Sent by the child once the save is on disk; anything else is a failure
+static const byte SAVE_OK = 1;
+
+Autosave::~Autosave() { this->Wait(); }
+
+bool Autosave::Start(const Sim& sim, const char* path, const SavePlan& plan) {
+  if (this->InFlight()) {
+    return false;
+  }
+  int fds[2];
+  if (pipe(fds) != 0) {
+    std::cout << "Autosave: could not create pipe" << std::endl;
+    return false;
+  }
+
+  // Anything still buffered would otherwise be written twice
+  std::cout.flush();
+  std::fflush(nullptr);
+  pid_t pid = fork();
+  if (pid < 0) {
+    close(fds[0]);
+    close(fds[1]);
+    std::cout << "Autosave: fork failed" << std::endl;
+    return false;
+  }
+
+  if (pid == 0) {
+    // Child: only this thread exists here, and the save is single threaded.
+    // _exit skips destructors, which would try to join the parent's workers.
+    close(fds[0]);
+    byte result = SaveSimCompressed(sim, path, plan) ? SAVE_OK : 0;
+    ssize_t written = write(fds[1], &result, 1);
+    close(fds[1]);
+    _exit(written == 1 && result == SAVE_OK ? 0 : 1);
+  }
+
+  close(fds[1]);
+  fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+  this->child = pid;
+  this->pipe_fd = fds[0];
+  return true;
+}
+
+AutosaveStatus Autosave::Reap(bool ok) {
+  int status = 0;
+  while (waitpid(this->child, &status, 0) < 0 && errno == EINTR) {
+  }
+  close(this->pipe_fd);
+  this->child = -1;
+  this->pipe_fd = -1;
+  ok = ok && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+  if (!ok) {
+    std::cout << "Autosave failed" << std::endl;
+  }
+  return ok ? AutosaveStatus::Done : AutosaveStatus::Failed;
+}
+
+AutosaveStatus Autosave::Poll() {
+  if (!this->InFlight()) {
+    return AutosaveStatus::Idle;
+  }
+  byte result = 0;
+  ssize_t n = read(this->pipe_fd, &result, 1);
+  if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+    return AutosaveStatus::InFlight;
+  }
+  // End of file without a result means the child died
+  return this->Reap(n == 1 && result == SAVE_OK);
+}
+
+AutosaveStatus Autosave::Wait() {
+  if (!this->InFlight()) {
+    return AutosaveStatus::Idle;
+  }
+  fcntl(this->pipe_fd, F_SETFL, fcntl(this->pipe_fd, F_GETFL) & ~O_NONBLOCK);
+  byte result = 0;
+  ssize_t n;
+  do {
+    n = read(this->pipe_fd, &result, 1);
+  } while (n < 0 && errno == EINTR);
+  return this->Reap(n == 1 && result == SAVE_OK);
+}
+
+} // namespace simulation
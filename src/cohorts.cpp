@@ -0,0 +1,114 @@
+#include <cohorts.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <vector>
+
+#include <simulation.h>
+
+namespace simulation {
+
+// `kept` is scratch indexed by pop type, all null on entry and on return.
+// Merged pops are unlinked and added to `merged_away` but not freed yet.
+static usize MergeLocation(Sim& sim, Location& location,
+    std::vector<Pop*>& kept, std::vector<Pop*>& merged_away) {
+  auto& list = *location.pops_at_location;
+  if (list.size() < 2) {
+    return 0;
+  }
+
+  usize merged = 0;
+  u32 location_slot = sim.locations.IndexOf(location);
+  for (auto* pop : list) {
+    auto*& into = kept[pop->type->id.idx];
+    if (!into) {
+      into = pop;
+      continue;
+    }
+
+    sim.pops.Touch(*into);
+    into->size += pop->size;
+    into->money += pop->money;
+    f64 carry = into->growth_carry + pop->growth_carry;
+    f64 whole = std::floor(carry);
+    into->size += i64(whole);
+    into->growth_carry = carry - whole;
+    if (whole != 0.0) {
+      sim.aggregates.Add(location_slot, {.population = i64(whole)});
+    }
+
+    pop->generation++;
+    pop->merged_into = into;
+    pop->merged_into_generation = into->generation;
+    merged++;
+  }
+
+  for (auto* pop : list) {
+    kept[pop->type->id.idx] = nullptr;
+  }
+  if (merged > 0) {
+    sim.locations.Touch(location);
+    std::erase_if(list, [&](Pop* pop) {
+      if (IsValid(*pop)) {
+        return false;
+      }
+      merged_away.push_back(pop);
+      return true;
+    });
+  }
+  return merged;
+}
+
+// Points pending events at the pops that absorbed their targets, then frees
+// the merged pops. Once a slot is reused its forward is gone, so an event
+// still naming it would resolve to nothing and be dropped.
+static void Retire(Sim& sim, std::vector<Pop*>& merged_away) {
+  if (merged_away.empty()) {
+    return;
+  }
+  auto retarget = [](EntityId& id) {
+    if (id.kind != EntityIdKind::Pop || id.IsValid()) {
+      return;
+    }
+    auto resolved = Resolve(id);
+    if (resolved.IsValid()) {
+      id = resolved;
+    }
+  };
+  sim.events.ForEachPending([&](u64, Event& event) {
+    retarget(event.target);
+    retarget(event.destination);
+  });
+  for (auto* pop : merged_away) {
+    sim.pops.Deallocate(*pop);
+  }
+}
+
+usize MergeCohorts(Sim& sim, std::span<Location* const> locations) {
+  std::vector<Pop*> kept(sim.pop_types.size(), nullptr);
+  std::vector<Pop*> merged_away;
+  usize merged = 0;
+  for (auto* location : locations) {
+    if (IsValid(*location)) {
+      merged += MergeLocation(sim, *location, kept, merged_away);
+    }
+  }
+  Retire(sim, merged_away);
+  return merged;
+}
+
+usize MergeAllCohorts(Sim& sim) {
+  std::vector<Pop*> kept(sim.pop_types.size(), nullptr);
+  std::vector<Pop*> merged_away;
+  usize merged = 0;
+  for (auto& location : sim.locations) {
+    if (IsValid(location)) {
+      merged += MergeLocation(sim, location, kept, merged_away);
+    }
+  }
+  Retire(sim, merged_away);
+  return merged;
+}
+
+} // namespace simulation
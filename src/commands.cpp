@@ -0,0 +1,225 @@
+#include <commands.h>
+
+#include <algorithm>
+#include <cassert>
+#include <utility>
+
+#include <cohorts.h>
+#include <jobs.h>
+#include <simulation.h>
+
+namespace simulation {
+
+CommandBuffer& Commands::Local() {
+  usize idx = jobs::ThreadIndex();
+  assert(idx < this->buffers.size());
+  return this->buffers[idx];
+}
+
+// Parent/child relationship edits collected while applying commands.
+template <typename Parent, typename Child> struct Relink {
+  std::vector<Parent*> touched;
+  std::vector<std::pair<Parent*, Child*>> arrivals;
+
+  void Leave(Parent* parent) {
+    if (parent) {
+      this->touched.push_back(parent);
+    }
+  }
+
+  void Arrive(Parent* parent, Child* child) {
+    if (parent) {
+      this->touched.push_back(parent);
+      this->arrivals.push_back({parent, child});
+    }
+  }
+};
+
+// Rebuilds each touched parent's list in one pass: children still pointing at
+// the parent are kept in place, then new arrivals are appended in command
+// order. `marks` is scratch space, one flag per slot of the child pool.
+template <typename Parent, typename Child, typename ListOf, typename ParentOf>
+static void RebuildLists(Relink<Parent, Child>& relink, Pool<Parent>& parents,
+    const Pool<Child>& pool, std::vector<bool>& marks, ListOf list_of,
+    ParentOf parent_of) {
+  auto& touched = relink.touched;
+  std::sort(touched.begin(), touched.end());
+  touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+
+  auto& arrivals = relink.arrivals;
+  std::stable_sort(arrivals.begin(), arrivals.end(),
+      [](const auto& a, const auto& b) { return a.first < b.first; });
+
+  marks.assign(pool.Capacity(), false);
+  auto belongs = [&](Parent* parent, const Child* child) {
+    return IsValid(*child) && parent_of(*child) == parent;
+  };
+
+  usize next_arrival = 0;
+  for (auto* parent : touched) {
+    parents.Touch(*parent);
+    auto& list = *list_of(*parent);
+    std::erase_if(list, [&](Child* child) { return !belongs(parent, child); });
+    for (auto* child : list) {
+      marks[pool.IndexOf(*child)] = true;
+    }
+
+    while (next_arrival < arrivals.size() &&
+           arrivals[next_arrival].first < parent) {
+      next_arrival++;
+    }
+    while (next_arrival < arrivals.size() &&
+           arrivals[next_arrival].first == parent) {
+      auto* child = arrivals[next_arrival].second;
+      usize idx = pool.IndexOf(*child);
+      if (belongs(parent, child) && !marks[idx]) {
+        list.push_back(child);
+        marks[idx] = true;
+      }
+      next_arrival++;
+    }
+
+    for (auto* child : list) {
+      marks[pool.IndexOf(*child)] = false;
+    }
+  }
+}
+
+void ApplyCommands(Sim& sim) {
+  // Merge all buffers into one deterministic sequence
+  std::vector<Command> commands;
+  {
+    usize total = 0;
+    for (const auto& buffer : sim.commands.buffers) {
+      total += buffer.commands.size();
+    }
+    if (total == 0) {
+      return;
+    }
+    commands.reserve(total);
+    for (auto& buffer : sim.commands.buffers) {
+      commands.insert(
+          commands.end(), buffer.commands.begin(), buffer.commands.end());
+      buffer.commands.clear();
+    }
+    std::sort(commands.begin(), commands.end(), [](const auto& a, const auto& b) {
+      return a.order != b.order ? a.order < b.order : a.seq < b.seq;
+    });
+  }
+
+  Relink<Location, Pop> pop_links;
+  Relink<Location, Building> building_links;
+  // Slots are released only after the lists are rebuilt, so a create in the
+  // same batch can never reuse a slot that some list still points at
+  std::vector<Pop*> dead_pops;
+  std::vector<Building*> dead_buildings;
+
+  auto& aggregates = sim.aggregates;
+  auto slot = [&](const Location* location) {
+    return u32(sim.locations.IndexOf(*location));
+  };
+
+  for (const auto& command : commands) {
+    switch (command.kind) {
+    case CommandKind::CreatePop: {
+      assert(command.location && command.pop_type);
+      auto& pop = sim.pops.Allocate();
+      pop.generation++;
+      pop.type = command.pop_type;
+      pop.size = command.size;
+      pop.location = command.location;
+      pop_links.Arrive(pop.location, &pop);
+      aggregates.Add(slot(pop.location), TotalsOf(pop));
+      break;
+    }
+    case CommandKind::CreateBuilding: {
+      assert(command.location && command.building_type);
+      auto& building = sim.buildings.Allocate();
+      building.generation++;
+      building.type = command.building_type;
+      building.size = command.size;
+      building.location = command.location;
+      building_links.Arrive(building.location, &building);
+      aggregates.Add(slot(building.location), TotalsOf(building));
+      break;
+    }
+    case CommandKind::DestroyPop: {
+      auto* pop = command.pop;
+      if (!IsValid(*pop)) {
+        break;
+      }
+      pop->generation++;
+      // Savings of the dead leave the economy
+      sim.ledger.world += std::exchange(pop->money, 0);
+      pop_links.Leave(pop->location);
+      aggregates.Add(slot(pop->location), Negate(TotalsOf(*pop)));
+      dead_pops.push_back(pop);
+      break;
+    }
+    case CommandKind::DestroyBuilding: {
+      auto* building = command.building;
+      if (!IsValid(*building)) {
+        break;
+      }
+      building->generation++;
+      sim.ledger.world += std::exchange(building->money, 0);
+      building_links.Leave(building->location);
+      aggregates.Add(slot(building->location), Negate(TotalsOf(*building)));
+      dead_buildings.push_back(building);
+      break;
+    }
+    case CommandKind::MovePop: {
+      auto* pop = command.pop;
+      if (!IsValid(*pop) || !IsValid(*command.location) ||
+          pop->location == command.location) {
+        break;
+      }
+      pop_links.Leave(pop->location);
+      aggregates.Add(slot(pop->location), Negate(TotalsOf(*pop)));
+      sim.pops.Touch(*pop);
+      pop->location = command.location;
+      pop_links.Arrive(pop->location, pop);
+      aggregates.Add(slot(pop->location), TotalsOf(*pop));
+      break;
+    }
+    case CommandKind::ChangeOwner: {
+      auto* location = command.location;
+      if (!IsValid(*location) || location->owner_country == command.country) {
+        break;
+      }
+      ChangeLocationOwner(sim, command.country, location);
+      break;
+    }
+    case CommandKind::TransferAll: {
+      assert(command.from_country && command.country);
+      if (!IsValid(*command.from_country) || !IsValid(*command.country)) {
+        break;
+      }
+      TransferAll(sim, *command.from_country, *command.country);
+      break;
+    }
+    }
+  }
+
+  std::vector<bool> marks;
+  RebuildLists(
+      pop_links, sim.locations, sim.pops, marks,
+      [](Location& location) { return location.pops_at_location.get(); },
+      [](const Pop& pop) { return pop.location; });
+  RebuildLists(
+      building_links, sim.locations, sim.buildings, marks,
+      [](Location& location) { return location.buildings_at_location.get(); },
+      [](const Building& building) { return building.location; });
+
+  // Merge on insert: arrivals fold into a resident pop of the same type
+  MergeCohorts(sim, pop_links.touched);
+
+  for (auto* pop : dead_pops) {
+    sim.pops.Deallocate(*pop);
+  }
+  for (auto* building : dead_buildings) {
+    sim.buildings.Deallocate(*building);
+  }
+}
+
+} // namespace simulation
@@ -0,0 +1,359 @@
+#include <digest.h>
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <functional>
+#include <limits>
+
+#include <jobs.h>
+#include <simulation.h>
+
+namespace simulation {
+
+static const u32 NIL = std::numeric_limits<u32>::max();
+// Slots hashed per job
+static const usize HASH_BLOCK = 4096;
+// Market rows hashed per job; a row holds every good of a location
+static const usize MARKET_BLOCK = 256;
+
+// splitmix64 finalizer
+static inline u64 Mix(u64 x) {
+  x ^= x >> 30;
+  x *= 0xBF58476D1CE4E5B9ull;
+  x ^= x >> 27;
+  x *= 0x94D049BB133111EBull;
+  x ^= x >> 31;
+  return x;
+}
+
+class Hasher {
+private:
+  u64 state;
+
+public:
+  explicit Hasher(u64 key) : state(Mix(key + 0x9E3779B97F4A7C15ull)) {}
+
+  void Add(u64 value) { this->state = Mix(this->state + value); }
+  void Add(i64 value) { this->Add(u64(value)); }
+  void Add(u32 value) { this->Add(u64(value)); }
+  void Add(f64 value) { this->Add(std::bit_cast<u64>(value)); }
+  void Add(f32 value) { this->Add(u64(std::bit_cast<u32>(value))); }
+
+  // FNV-1a over the bytes, added as one value
+  void Add(const char* string) {
+    u64 h = 0xCBF29CE484222325ull;
+    for (const char* c = string; *c; ++c) {
+      h = (h ^ u8(*c)) * 0x100000001B3ull;
+    }
+    this->Add(h);
+  }
+
+  u64 Value() const { return this->state; }
+};
+
+template <typename T> static inline u32 SlotOf(const Pool<T>& pool, const T* ptr) {
+  return ptr ? u32(pool.IndexOf(*ptr)) : NIL;
+}
+
+static u64 HashPop(const Sim& sim, u32 slot) {
+  const auto& pop = sim.pops[slot];
+  Hasher h(slot);
+  h.Add(pop.generation);
+  // Merged pops keep their forward link after they die, see Resolve
+  h.Add(SlotOf(sim.pops, (const Pop*)pop.merged_into));
+  h.Add(pop.merged_into_generation);
+  if (IsValid(pop)) {
+    h.Add(u64(pop.type - sim.pop_types.data()));
+    h.Add(pop.size);
+    h.Add(pop.growth_carry);
+    h.Add(pop.money);
+    h.Add(SlotOf(sim.locations, (const Location*)pop.location));
+    h.Add(SlotOf(sim.pops, (const Pop*)pop.location_chain_next));
+  }
+  return h.Value();
+}
+
+static u64 HashBuilding(const Sim& sim, u32 slot) {
+  const auto& building = sim.buildings[slot];
+  Hasher h(slot);
+  h.Add(building.generation);
+  if (IsValid(building)) {
+    h.Add(u64(building.type - sim.building_types.data()));
+    h.Add(building.size);
+    h.Add(building.money);
+    h.Add(SlotOf(sim.locations, (const Location*)building.location));
+  }
+  return h.Value();
+}
+
+static u64 HashLocation(const Sim& sim, u32 slot) {
+  const auto& location = sim.locations[slot];
+  Hasher h(slot);
+  h.Add(location.generation);
+  if (IsValid(location)) {
+    h.Add(location.tag);
+    h.Add(location.name);
+    h.Add(location.coords.x);
+    h.Add(location.coords.y);
+    h.Add(SlotOf(sim.countries, (const Country*)location.owner_country));
+    h.Add(location.owned_index);
+    h.Add(u64(location.pops_at_location->size()));
+    for (const auto* pop : *location.pops_at_location) {
+      h.Add(SlotOf(sim.pops, pop));
+    }
+    h.Add(u64(location.buildings_at_location->size()));
+    for (const auto* building : *location.buildings_at_location) {
+      h.Add(SlotOf(sim.buildings, building));
+    }
+  }
+  return h.Value();
+}
+
+static u64 HashCountry(const Sim& sim, u32 slot) {
+  const auto& country = sim.countries[slot];
+  Hasher h(slot);
+  h.Add(country.generation);
+  if (IsValid(country)) {
+    h.Add(country.tag);
+    h.Add(country.name);
+    h.Add(u64(country.color.r) | u64(country.color.g) << 8 |
+          u64(country.color.b) << 16);
+    h.Add(country.money);
+    h.Add(u64(country.owned_locations->size()));
+    for (const auto* location : *country.owned_locations) {
+      h.Add(SlotOf(sim.locations, location));
+    }
+  }
+  return h.Value();
+}
+
+static u32 EventTarget(const Sim& sim, const EntityId& target) {
+  switch (target.kind) {
+  case EntityIdKind::Location:
+    return SlotOf(sim.locations, (const Location*)target.handle);
+  case EntityIdKind::Building:
+    return SlotOf(sim.buildings, (const Building*)target.handle);
+  case EntityIdKind::Pop:
+    return SlotOf(sim.pops, (const Pop*)target.handle);
+  case EntityIdKind::INVALID:
+    break;
+  }
+  return NIL;
+}
+
+// Markets and GDP of every location, one hash per location summed like pool
+// slots, so the rows can be hashed in parallel
+static u64 HashMarketRows(const Sim& sim) {
+  const auto& markets = sim.markets;
+  usize num_goods = markets.num_goods;
+  usize num_rows = num_goods ? markets.price.size() / num_goods : 0;
+  usize num_locations = sim.locations.Capacity();
+  return jobs::Reduce(
+      0, std::max(num_rows, num_locations), MARKET_BLOCK, u64(0),
+      [&](usize lo, usize hi) {
+        u64 sum = 0;
+        for (usize row = lo; row < hi; ++row) {
+          Hasher h(row);
+          if (row < num_rows) {
+            for (usize idx = row * num_goods; idx < (row + 1) * num_goods; ++idx) {
+              h.Add(markets.supply[idx]);
+              h.Add(markets.demand[idx]);
+              h.Add(markets.imports[idx]);
+              h.Add(markets.exports[idx]);
+              h.Add(markets.price[idx]);
+            }
+          }
+          if (row < num_locations) {
+            h.Add(sim.aggregates.AtLocation(u32(row)).gdp);
+          }
+          sum += h.Value();
+        }
+        return sum;
+      },
+      std::plus<u64>());
+}
+
+// Hashed whole on every update; the market rows go through HashMarketRows
+static u64 HashGlobals(const Sim& sim) {
+  Hasher h(u64(DigestPart::Globals));
+  h.Add(sim.date.epoch);
+  h.Add(sim.seed);
+  h.Add(sim.ledger.world);
+  h.Add(SlotOf(sim.countries, (const Country*)sim.player.country));
+
+  const auto& edges = sim.location_graph.Edges();
+  h.Add(u64(edges.size()));
+  for (const auto& edge : edges) {
+    h.Add(edge.a);
+    h.Add(edge.b);
+    h.Add(edge.cost);
+  }
+
+  const auto& markets = sim.markets;
+  h.Add(u64(markets.num_goods));
+  for (const auto* column : {&markets.supply, &markets.demand, &markets.imports,
+           &markets.exports, &markets.price}) {
+    assert(column->size() == markets.price.size());
+    h.Add(u64(column->size()));
+  }
+  h.Add(HashMarketRows(sim));
+
+  // Timer slots depend on scheduling history, so events are summed
+  u64 events = 0;
+  sim.events.ForEachPending([&](u64 due, const Event& event) {
+    Hasher e(due);
+    e.Add(u64(event.kind));
+    e.Add(u64(event.target.kind));
+    e.Add(EventTarget(sim, event.target));
+    e.Add(event.target.generation);
+    e.Add(EventTarget(sim, event.destination));
+    e.Add(event.destination.generation);
+    e.Add(event.amount);
+    events += e.Value();
+  });
+  h.Add(sim.events.Now());
+  h.Add(events);
+  return h.Value();
+}
+
+// Adds the new hash of every slot below the frontier that `rehash` picks,
+// and returns how much the sum moved
+template <typename T, typename Rehash, typename HashOf>
+static u64 HashSlots(const Pool<T>& pool, std::vector<u64>* slots,
+    Rehash rehash, HashOf hash_of) {
+  return jobs::Reduce(
+      0, pool.Frontier(), HASH_BLOCK, u64(0),
+      [&](usize lo, usize hi) {
+        u64 delta = 0;
+        for (usize idx = lo; idx < hi; ++idx) {
+          if (!rehash(idx)) {
+            continue;
+          }
+          u64 hash = hash_of(u32(idx));
+          if (slots) {
+            delta += hash - (*slots)[idx];
+            (*slots)[idx] = hash;
+          } else {
+            delta += hash;
+          }
+        }
+        return delta;
+      },
+      std::plus<u64>());
+}
+
+template <typename T, typename HashOf>
+static u64 UpdatePool(PoolHashes& hashes, Pool<T>& pool,
+    HashOf hash_of) {
+  u32 since = hashes.since;
+  bool all = hashes.slots.size() != pool.Capacity();
+  if (all) {
+    hashes.slots.assign(pool.Capacity(), 0);
+    hashes.sum = 0;
+  }
+  hashes.since = pool.Checkpoint();
+  hashes.sum += HashSlots(
+      pool, &hashes.slots,
+      [&](usize idx) { return all || pool.StampOf(idx) > since; }, hash_of);
+  return hashes.sum;
+}
+
+const char* ToString(DigestPart part) {
+  switch (part) {
+  case DigestPart::Pops:
+    return "pops";
+  case DigestPart::Buildings:
+    return "buildings";
+  case DigestPart::Locations:
+    return "locations";
+  case DigestPart::Countries:
+    return "countries";
+  case DigestPart::Globals:
+    return "globals";
+  case DigestPart::COUNT:
+    break;
+  }
+  return "unknown";
+}
+
+u64 Digest::Whole() const {
+  Hasher h(u64(DigestPart::COUNT));
+  for (u64 part : this->parts) {
+    h.Add(part);
+  }
+  return h.Value();
+}
+
+const Digest& StateHasher::Update(Sim& sim) {
+  auto& parts = this->digest.parts;
+  parts[usize(DigestPart::Pops)] =
+      UpdatePool(this->pools[usize(DigestPart::Pops)], sim.pops,
+          [&](u32 slot) { return HashPop(sim, slot); });
+  parts[usize(DigestPart::Buildings)] =
+      UpdatePool(this->pools[usize(DigestPart::Buildings)], sim.buildings,
+          [&](u32 slot) { return HashBuilding(sim, slot); });
+  parts[usize(DigestPart::Locations)] =
+      UpdatePool(this->pools[usize(DigestPart::Locations)], sim.locations,
+          [&](u32 slot) { return HashLocation(sim, slot); });
+  parts[usize(DigestPart::Countries)] =
+      UpdatePool(this->pools[usize(DigestPart::Countries)], sim.countries,
+          [&](u32 slot) { return HashCountry(sim, slot); });
+  parts[usize(DigestPart::Globals)] = HashGlobals(sim);
+  return this->digest;
+}
+
+void StateHasher::Reset() {
+  for (auto& hashes : this->pools) {
+    hashes = {};
+  }
+  this->digest = {};
+}
+
+u64 StateHasher::SlotHash(DigestPart part, u32 slot) const {
+  assert(part < DigestPart::Globals);
+  const auto& slots = this->pools[usize(part)].slots;
+  return slot < slots.size() ? slots[slot] : 0;
+}
+
+bool FindDivergence(
+    const StateHasher& a, const StateHasher& b, Divergence& divergence) {
+  for (usize part = 0; part < NUM_DIGEST_PARTS; ++part) {
+    if (a.digest.parts[part] == b.digest.parts[part]) {
+      continue;
+    }
+    divergence = {.part = DigestPart(part)};
+    if (divergence.part == DigestPart::Globals) {
+      return true;
+    }
+    const auto& slots_a = a.pools[part].slots;
+    const auto& slots_b = b.pools[part].slots;
+    usize n = std::max(slots_a.size(), slots_b.size());
+    for (u32 slot = 0; slot < n; ++slot) {
+      if (a.SlotHash(divergence.part, slot) != b.SlotHash(divergence.part, slot)) {
+        divergence.slot = slot;
+        break;
+      }
+    }
+    return true;
+  }
+  return false;
+}
+
+Digest DigestSim(const Sim& sim) {
+  auto all = [](usize) { return true; };
+  Digest digest;
+  auto& parts = digest.parts;
+  parts[usize(DigestPart::Pops)] = HashSlots(sim.pops, nullptr, all,
+      [&](u32 slot) { return HashPop(sim, slot); });
+  parts[usize(DigestPart::Buildings)] = HashSlots(sim.buildings, nullptr, all,
+      [&](u32 slot) { return HashBuilding(sim, slot); });
+  parts[usize(DigestPart::Locations)] = HashSlots(sim.locations, nullptr, all,
+      [&](u32 slot) { return HashLocation(sim, slot); });
+  parts[usize(DigestPart::Countries)] = HashSlots(sim.countries, nullptr, all,
+      [&](u32 slot) { return HashCountry(sim, slot); });
+  parts[usize(DigestPart::Globals)] = HashGlobals(sim);
+  return digest;
+}
+
+} // namespace simulation
@@ -0,0 +1,163 @@
+#include <history.h>
+
+#include <algorithm>
+#include <cassert>
+
+#include <jobs.h>
+#include <simulation.h>
+
+namespace simulation {
+
+// Series sampled per job
+static const usize SAMPLE_CHUNK = 4096;
+
+// Days covered by one bucket; years are closed from monthly buckets
+static const std::array<u64, NUM_TIERS> PERIOD_DAYS{
+    1, 7, DAYS_PER_MONTH, DAYS_PER_YEAR};
+
+void History::Init(const Sim& sim, const HistoryOptions& options) {
+  assert(options.capacity[usize(Tier::Daily)] >= DAYS_PER_MONTH);
+  assert(options.capacity[usize(Tier::Monthly)] >=
+         DAYS_PER_YEAR / DAYS_PER_MONTH);
+  this->options = options;
+  this->num_goods = sim.markets.num_goods;
+  this->num_series[usize(Metric::Price)] = sim.markets.price.size();
+  this->num_series[usize(Metric::Supply)] = sim.markets.supply.size();
+  this->num_series[usize(Metric::Population)] = sim.locations.Capacity();
+
+  for (usize metric = 0; metric < NUM_METRICS; ++metric) {
+    for (usize tier = 0; tier < NUM_TIERS; ++tier) {
+      auto& ring = this->rings[metric][tier];
+      ring = {};
+      ring.capacity = options.capacity[tier];
+      for (usize stat = 0; stat < NUM_STATS; ++stat) {
+        // Daily samples only need the one column
+        if (tier == usize(Tier::Daily) && stat != usize(Stat::Mean)) {
+          continue;
+        }
+        ring.columns[stat].assign(
+            this->num_series[metric] * 2 * ring.capacity, 0.0f);
+      }
+    }
+  }
+}
+
+// Writes one entry of a series at the ring head, and its mirror
+void History::Push(
+    Metric metric, Tier tier, usize series, f32 min, f32 max, f32 mean) {
+  auto& ring = this->rings[usize(metric)][usize(tier)];
+  usize at = series * 2 * ring.capacity + ring.head;
+  auto write = [&](Stat stat, f32 value) {
+    auto& column = ring.columns[usize(stat)];
+    column[at] = value;
+    column[at + ring.capacity] = value;
+  };
+  write(Stat::Mean, mean);
+  if (tier != Tier::Daily) {
+    write(Stat::Min, min);
+    write(Stat::Max, max);
+  }
+}
+
+// Called once every series of the tier has had its entry pushed
+void History::Advance(Metric metric, Tier tier) {
+  auto& ring = this->rings[usize(metric)][usize(tier)];
+  ring.head = (ring.head + 1) % ring.capacity;
+  ring.count = std::min(ring.count + 1, ring.capacity);
+}
+
+// Rolls the last `span` entries of the finer tier into one bucket
+void History::CloseBucket(Metric metric, Tier tier, Tier from, usize span) {
+  span = std::min(span, this->Count(metric, from));
+  if (span == 0) {
+    return;
+  }
+  jobs::ParallelFor(
+      0, this->num_series[usize(metric)], SAMPLE_CHUNK, [&](usize lo, usize hi) {
+        for (usize series = lo; series < hi; ++series) {
+          auto mins = this->Latest(metric, from, Stat::Min, series, span);
+          auto maxs = this->Latest(metric, from, Stat::Max, series, span);
+          auto means = this->Latest(metric, from, Stat::Mean, series, span);
+          f64 sum = 0.0;
+          for (f32 mean : means) {
+            sum += mean;
+          }
+          this->Push(metric, tier, series,
+              *std::min_element(mins.begin(), mins.end()),
+              *std::max_element(maxs.begin(), maxs.end()), f32(sum / f64(span)));
+        }
+      });
+  this->Advance(metric, tier);
+}
+
+void History::Sample(const Sim& sim) {
+  if (this->num_series[usize(Metric::Price)] != sim.markets.price.size() ||
+      this->num_series[usize(Metric::Population)] != sim.locations.Capacity() ||
+      this->num_goods != sim.markets.num_goods) {
+    this->Init(sim, this->options);
+  }
+
+  auto sample = [&](Metric metric, auto value_of) {
+    jobs::ParallelFor(0, this->num_series[usize(metric)], SAMPLE_CHUNK,
+        [&](usize lo, usize hi) {
+          for (usize series = lo; series < hi; ++series) {
+            f32 value = f32(value_of(series));
+            this->Push(metric, Tier::Daily, series, value, value, value);
+          }
+        });
+    this->Advance(metric, Tier::Daily);
+  };
+  sample(Metric::Price, [&](usize at) { return sim.markets.price[at]; });
+  sample(Metric::Supply, [&](usize at) { return sim.markets.supply[at]; });
+  sample(Metric::Population, [&](usize location) {
+    return sim.aggregates.AtLocation(location).population;
+  });
+
+  // Buckets close on calendar boundaries; the first ones may be partial
+  u64 day = sim.date.epoch;
+  for (usize metric = 0; metric < NUM_METRICS; ++metric) {
+    auto& rings = this->rings[metric];
+    for (Tier tier : {Tier::Weekly, Tier::Monthly}) {
+      auto& ring = rings[usize(tier)];
+      ring.pending++;
+      if (day % PERIOD_DAYS[usize(tier)] == 0) {
+        this->CloseBucket(Metric(metric), tier, Tier::Daily, ring.pending);
+        ring.pending = 0;
+        if (tier == Tier::Monthly) {
+          rings[usize(Tier::Yearly)].pending++;
+        }
+      }
+    }
+    auto& yearly = rings[usize(Tier::Yearly)];
+    if (day % PERIOD_DAYS[usize(Tier::Yearly)] == 0 && yearly.pending > 0) {
+      this->CloseBucket(Metric(metric), Tier::Yearly, Tier::Monthly, yearly.pending);
+      yearly.pending = 0;
+    }
+  }
+}
+
+std::span<const f32> History::Latest(
+    Metric metric, Tier tier, Stat stat, usize series, usize n) const {
+  const auto& ring = this->rings[usize(metric)][usize(tier)];
+  assert(series < this->num_series[usize(metric)]);
+  if (tier == Tier::Daily) {
+    stat = Stat::Mean;
+  }
+  n = std::min(n, ring.count);
+  usize begin = series * 2 * ring.capacity + ring.head + ring.capacity - n;
+  return {ring.columns[usize(stat)].data() + begin, n};
+}
+
+usize History::Bytes() const {
+  usize bytes = 0;
+  for (const auto& rings : this->rings) {
+    for (const auto& ring : rings) {
+      for (const auto& column : ring.columns) {
+        bytes += column.capacity() * sizeof(f32);
+      }
+    }
+  }
+  return bytes;
+}
+
+} // namespace simulation
@@ -0,0 +1,163 @@
+#include <jobs.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace jobs {
+
+struct Batch {
+  const Task* task{nullptr};
+  usize count{0};
+  std::atomic<usize> next{0};
+  std::atomic<usize> done{0};
+  // Workers currently holding a pointer to the batch
+  usize users{0};
+};
+
+struct State {
+  std::vector<std::thread> threads;
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable finished;
+  // Bumped every time a new batch is published
+  u64 batch_id{0};
+  Batch* batch{nullptr};
+  bool quit{false};
+  // Serializes concurrent Run calls coming from different outside threads
+  std::mutex submit;
+};
+
+static State state;
+static thread_local usize thread_index = 0;
+static thread_local bool inside_task = false;
+
+// Pulls items off the batch until it is exhausted
+static inline void Drain(Batch& batch) {
+  usize completed = 0;
+  while (true) {
+    usize idx = batch.next.fetch_add(1, std::memory_order_relaxed);
+    if (idx >= batch.count) {
+      break;
+    }
+    inside_task = true;
+    (*batch.task)(idx);
+    inside_task = false;
+    completed++;
+  }
+  if (completed > 0) {
+    usize total = batch.done.fetch_add(completed) + completed;
+    if (total == batch.count) {
+      std::lock_guard lock(state.mutex);
+      state.finished.notify_all();
+    }
+  }
+}
+
+static void WorkerMain(usize index) {
+  thread_index = index;
+  u64 seen = 0;
+  while (true) {
+    Batch* batch = nullptr;
+    {
+      std::unique_lock lock(state.mutex);
+      state.wake.wait(lock, [&] { return state.quit || state.batch_id != seen; });
+      if (state.quit) {
+        return;
+      }
+      seen = state.batch_id;
+      batch = state.batch;
+      if (batch) {
+        batch->users++;
+      }
+    }
+    if (batch) {
+      Drain(*batch);
+      std::lock_guard lock(state.mutex);
+      batch->users--;
+      state.finished.notify_all();
+    }
+  }
+}
+
+void Init(usize num_threads) {
+  assert(state.threads.empty());
+  if (num_threads == 0) {
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  state.quit = false;
+  for (usize i = 1; i < num_threads; ++i) {
+    state.threads.emplace_back(WorkerMain, i);
+  }
+}
+
+void Shutdown() {
+  {
+    std::lock_guard lock(state.mutex);
+    state.quit = true;
+  }
+  state.wake.notify_all();
+  for (auto& thread : state.threads) {
+    thread.join();
+  }
+  state.threads.clear();
+}
+
+usize NumThreads() {
+  return state.threads.size() + 1;
+}
+
+usize ThreadIndex() {
+  return thread_index;
+}
+
+void Run(usize count, const Task& task) {
+  if (count == 0) {
+    return;
+  }
+  // Serial fallback: no workers, a single item, or a nested call
+  if (state.threads.empty() || count == 1 || inside_task) {
+    for (usize i = 0; i < count; ++i) {
+      task(i);
+    }
+    return;
+  }
+
+  std::lock_guard submit(state.submit);
+  Batch batch;
+  batch.task = &task;
+  batch.count = count;
+  {
+    std::lock_guard lock(state.mutex);
+    state.batch = &batch;
+    state.batch_id++;
+  }
+  state.wake.notify_all();
+
+  Drain(batch);
+
+  std::unique_lock lock(state.mutex);
+  state.finished.wait(lock, [&] {
+    return batch.done.load() == batch.count && batch.users == 0;
+  });
+  state.batch = nullptr;
+}
+
+void ParallelFor(usize begin, usize end, usize chunk, const RangeTask& task) {
+  if (end <= begin) {
+    return;
+  }
+  chunk = std::max<usize>(chunk, 1);
+  usize num_chunks = (end - begin + chunk - 1) / chunk;
+  Run(num_chunks, [&](usize i) {
+    usize lo = begin + i * chunk;
+    usize hi = std::min(end, lo + chunk);
+    task(lo, hi);
+  });
+}
+
+} // namespace jobs
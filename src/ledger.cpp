@@ -0,0 +1,166 @@
+#include <ledger.h>
+
+#include <cassert>
+#include <iostream>
+
+#include <jobs.h>
+#include <simulation.h>
+
+namespace simulation {
+
+// One side of a transaction
+struct Posting {
+  Account account;
+  Money delta{0};
+};
+
+LedgerBuffer& Ledger::Local() {
+  usize idx = jobs::ThreadIndex();
+  assert(idx < this->buffers.size());
+  return this->buffers[idx];
+}
+
+static inline Money& BalanceOf(Sim& sim, Account account) {
+  switch (account.kind) {
+  case AccountKind::Country:
+    assert(IsValid(sim.countries[account.index]));
+    sim.countries.Touch(sim.countries[account.index]);
+    return sim.countries[account.index].money;
+  case AccountKind::Pop:
+    assert(IsValid(sim.pops[account.index]));
+    sim.pops.Touch(sim.pops[account.index]);
+    return sim.pops[account.index].money;
+  case AccountKind::Building:
+    assert(IsValid(sim.buildings[account.index]));
+    sim.buildings.Touch(sim.buildings[account.index]);
+    return sim.buildings[account.index].money;
+  case AccountKind::World:
+    break;
+  }
+  return sim.ledger.world;
+}
+
+static inline const Country* CountryOf(const Sim& sim, Account account) {
+  switch (account.kind) {
+  case AccountKind::Country:
+    return &sim.countries[account.index];
+  case AccountKind::Pop:
+    return sim.pops[account.index].location->owner_country;
+  case AccountKind::Building:
+    return sim.buildings[account.index].location->owner_country;
+  case AccountKind::World:
+    break;
+  }
+  return nullptr;
+}
+
+// Slots summed per block of the reduction
+static const usize TOTAL_BLOCK = 4096;
+
+template <typename T>
+static Money SumMoney(const Pool<T>& pool) {
+  return jobs::Reduce(
+      usize(0), pool.Capacity(), TOTAL_BLOCK, Money(0),
+      [&](usize begin, usize end) {
+        Money sum = 0;
+        for (usize idx = begin; idx < end; ++idx) {
+          sum += IsValid(pool[idx]) ? pool[idx].money : 0;
+        }
+        return sum;
+      },
+      [](Money a, Money b) { return a + b; });
+}
+
+Money TotalMoney(const Sim& sim) {
+  return sim.ledger.world + SumMoney(sim.countries) + SumMoney(sim.pops) +
+         SumMoney(sim.buildings);
+}
+
+void ApplyLedger(Sim& sim) {
+  auto& ledger = sim.ledger;
+  ledger.country_flows.assign(sim.countries.Capacity(), {});
+
+  usize num_transactions = 0;
+  for (const auto& buffer : ledger.buffers) {
+    num_transactions += buffer.transactions.size();
+  }
+  ledger.transactions_applied = num_transactions;
+  if (num_transactions == 0) {
+    return;
+  }
+
+#ifndef NDEBUG
+  Money total_before = TotalMoney(sim);
+#endif
+
+  // Group postings by shard, with the shard picked from the account slot so
+  // every posting of an account lands in the same one
+  usize num_shards = jobs::NumThreads();
+  auto shard_of = [&](Account account) { return account.index % num_shards; };
+
+  std::vector<usize> offsets(num_shards + 1, 0);
+  for (const auto& buffer : ledger.buffers) {
+    for (const auto& transaction : buffer.transactions) {
+      assert(transaction.amount > 0);
+      offsets[shard_of(transaction.from) + 1]++;
+      offsets[shard_of(transaction.to) + 1]++;
+    }
+  }
+  for (usize i = 0; i < num_shards; ++i) {
+    offsets[i + 1] += offsets[i];
+  }
+  std::vector<Posting> postings(offsets[num_shards]);
+  {
+    auto fill = offsets;
+    for (auto& buffer : ledger.buffers) {
+      for (const auto& transaction : buffer.transactions) {
+        postings[fill[shard_of(transaction.from)]++] = {
+            transaction.from, -transaction.amount};
+        postings[fill[shard_of(transaction.to)]++] = {
+            transaction.to, transaction.amount};
+      }
+      buffer.transactions.clear();
+    }
+  }
+
+  // Each shard posts to its own accounts and sums flows per country locally
+  usize num_countries = sim.countries.Capacity();
+  std::vector<CountryFlows> shard_flows(num_shards * num_countries);
+  jobs::Run(num_shards, [&](usize shard) {
+    auto* flows = &shard_flows[shard * num_countries];
+    for (usize i = offsets[shard]; i < offsets[shard + 1]; ++i) {
+      const auto& posting = postings[i];
+      BalanceOf(sim, posting.account) += posting.delta;
+
+      const auto* country = CountryOf(sim, posting.account);
+      if (!country) {
+        continue;
+      }
+      auto& country_flows = flows[sim.countries.IndexOf(*country)];
+      if (posting.delta > 0) {
+        country_flows.inflow += posting.delta;
+      } else {
+        country_flows.outflow -= posting.delta;
+      }
+    }
+  });
+
+  for (usize shard = 0; shard < num_shards; ++shard) {
+    for (usize c = 0; c < num_countries; ++c) {
+      const auto& flows = shard_flows[shard * num_countries + c];
+      ledger.country_flows[c].inflow += flows.inflow;
+      ledger.country_flows[c].outflow += flows.outflow;
+    }
+  }
+
+#ifndef NDEBUG
+  Money total_after = TotalMoney(sim);
+  if (total_before != total_after) {
+    std::cout << "Ledger does not balance: " << total_before << " before, "
+              << total_after << " after" << std::endl;
+    assert(false);
+  }
+#endif
+}
+
+} // namespace simulation
@@ -2,14 +2,27 @@
 #include "arena.h"
 #include "raylib.h"
 #include <raylib.h>
+#include <raymath.h>
 // Imgui
 #include <imgui.h>
 #include <imgui_impl_raylib.h>
 #include <rlImGui.h>
 // Simulation
 #include <core.h>
+#include <jobs.h>
+#include <map_render.h>
+#include <runner.h>
 #include <simulation.h>
 
+#include <cfloat>
+#include <cmath>
+#include <cstdlib>
+#include <deque>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
 using namespace arena;
 
 template <typename T>
@@ -25,29 +38,56 @@ struct Change {
 
 struct Actions {
   bool next_day{false};
+  bool save{false};
+  bool clear_marks{false};
+  Change<runner::Speed> speed;
 
   Change<simulation::EntityId> selection;
 };
+// Commands for the sim thread, kept in order until its queue takes them
+struct Outbox {
+  std::deque<runner::Command> pending;
+  // Reported once per stall, not every frame
+  bool stalled{false};
+
+  void Add(runner::Command command) { this->pending.push_back(command); }
+
+  void Flush(runner::Runner& runner) {
+    bool was_stalled = this->stalled;
+    while (!this->pending.empty() && runner.Push(this->pending.front())) {
+      this->pending.pop_front();
+    }
+    this->stalled = !this->pending.empty();
+    if (this->stalled && !was_stalled) {
+      std::cout << "Sim command queue is full, retrying " << this->pending.size()
+                << " command(s)" << std::endl;
+    }
+  }
+};
+
 struct Gui {
   bool window{false};
   ImFont* font{nullptr};
   Actions actions;
 };
 
-static inline void DrawGui(Gui& gui, const simulation::Sim& sim, Arena& arena,
-    simulation::EntityId selected_id) {
+// An item caught by a box selection
+struct MarkedItem {
+  simulation::EntityId id;
+  std::string name;
+};
+
+static inline void DrawGui(Gui& gui, const runner::Snapshot& snapshot,
+    simulation::EntityId selected_id, const std::vector<MarkedItem>& marked) {
   using namespace simulation;
   gui.actions = {};
 
   rlImGuiBegin();
   ImGui::PushFont(gui.font, 24.0f);
 
-  if (selected_id.IsValid()) {
-    auto ctx = ExtractCtx{
-        .arena = arena,
-        .sim = sim,
-    };
-    if (const auto* object = Extract(ctx, selected_id)) {
+  // The snapshot may still describe a previous selection for a frame or two
+  if (snapshot.selected_id == selected_id) {
+    if (const auto* object = snapshot.selected) {
       bool window_is_open = true;
       ImGui::Begin("Selected Entity", &window_is_open);
       // Overview table
@@ -74,10 +114,25 @@ static inline void DrawGui(Gui& gui, const simulation::Sim& sim, Arena& arena,
         kv_label("Name", Field::Name);
         kv_label("Size", Field::Size);
         kv_link("Country", Field::Country);
+        kv_label("Population", Field::Population);
+        kv_label("Output", Field::Output);
+        kv_label("GDP", Field::Gdp);
+        kv_label("Country population", Field::CountryPopulation);
+        kv_label("Country GDP", Field::CountryGdp);
 
         ImGui::EndTable();
       }
 
+      // Population history, when the selection is a location
+      auto plot = [](const char* label, const std::vector<f32>& values) {
+        if (values.size() > 1) {
+          ImGui::PlotLines(label, values.data(), int(values.size()), 0, nullptr,
+              FLT_MAX, FLT_MAX, ImVec2(0.0f, 60.0f));
+        }
+      };
+      plot("Daily", snapshot.population_daily);
+      plot("Monthly", snapshot.population_monthly);
+
       // Pop table
       if (auto* list = object->lists.TryGet(Field::Pops)) {
         ImGui::Separator();
@@ -133,15 +188,71 @@ static inline void DrawGui(Gui& gui, const simulation::Sim& sim, Arena& arena,
     }
   }
 
+  if (!marked.empty()) {
+    bool window_is_open = true;
+    ImGui::Begin("Box Selection", &window_is_open);
+    ImGui::Text("%zu locations", marked.size());
+    ImGui::BeginChild("marked_list", ImVec2(0.0f, 300.0f));
+    ImGuiListClipper clipper;
+    clipper.Begin(int(marked.size()));
+    while (clipper.Step()) {
+      for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; ++i) {
+        ImGui::PushID(i);
+        if (ImGui::TextLink(marked[i].name.c_str())) {
+          gui.actions.selection.Set(marked[i].id);
+        }
+        ImGui::PopID();
+      }
+    }
+    ImGui::EndChild();
+    ImGui::End();
+
+    if (!window_is_open) {
+      gui.actions.clear_marks = true;
+    }
+  }
+
   if (gui.window) {
     ImGui::Begin("Test", &gui.window, ImGuiWindowFlags_NoCollapse);
 
     ImGui::Text("FPS: %d", GetFPS());
+    ImGui::Text("Day: %llu", (unsigned long long)snapshot.date.epoch);
+    ImGui::Text("Last tick: %.3f ms", snapshot.stats.last_tick_ms);
 
     if (ImGui::Button("Advance time")) {
       gui.actions.next_day = true;
     }
 
+    // Speed controls
+    {
+      struct SpeedOption {
+        const char* label;
+        runner::Speed speed;
+      };
+      const SpeedOption options[] = {
+          {"Pause", runner::Speed::Paused},
+          {"1x", runner::Speed::X1},
+          {"2x", runner::Speed::X2},
+          {"5x", runner::Speed::X5},
+          {"Max", runner::Speed::Max},
+      };
+      for (const auto& option : options) {
+        ImGui::SameLine();
+        if (ImGui::RadioButton(option.label, snapshot.speed == option.speed)) {
+          gui.actions.speed.Set(option.speed);
+        }
+      }
+    }
+    ImGui::Text("Ticks/sec: %.1f", snapshot.stats.ticks_per_second);
+
+    if (ImGui::Button("Save")) {
+      gui.actions.save = true;
+    }
+    ImGui::SameLine();
+    ImGui::Text("Autosaves: %llu (%llu failed)",
+        (unsigned long long)snapshot.stats.autosaves,
+        (unsigned long long)snapshot.stats.failed_autosaves);
+
     ImGui::End();
   }
 
@@ -151,8 +262,15 @@ static inline void DrawGui(Gui& gui, const simulation::Sim& sim, Arena& arena,
 
 struct Board {
   Camera2D camera;
+  // Left button held since this screen position
+  bool dragging{false};
+  Vector2 drag_start{};
+  std::vector<MarkedItem> marked;
 };
 
+// Drags shorter than this are clicks
+static const f32 DRAG_THRESHOLD = 4.0f;
+
 void BoardInit(Board& board) {
   board.camera = {0};
   board.camera.offset = {GetScreenWidth() / 2.0f, GetScreenHeight() / 2.0f};
@@ -161,62 +279,84 @@ void BoardInit(Board& board) {
   board.camera.zoom = 1.0f;
 }
 
-Color ToRay(simulation::RGB color) {
-  return Color{.r = color.r, .g = color.g, .b = color.b, .a = 255};
+// Right drag pans, the wheel zooms about the cursor
+static inline void MoveCamera(Board& board) {
+  if (ImGui::GetIO().WantCaptureMouse) {
+    return;
+  }
+  auto& camera = board.camera;
+  if (IsMouseButtonDown(MOUSE_BUTTON_RIGHT)) {
+    auto delta = Vector2Scale(GetMouseDelta(), -1.0f / camera.zoom);
+    camera.target = Vector2Add(camera.target, delta);
+  }
+  f32 wheel = GetMouseWheelMove();
+  if (wheel != 0.0f) {
+    auto mouse = GetMousePosition();
+    camera.target = GetScreenToWorld2D(mouse, camera);
+    camera.offset = mouse;
+    camera.zoom = Clamp(camera.zoom * std::exp(0.2f * wheel), 0.001f, 8.0f);
+  }
 }
 
-static inline void Draw(Arena& arena, Board& board, const simulation::Sim& sim,
-    simulation::EntityId& selected_id) {
-  f32 scale = 40.0;
-
-  const auto items = simulation::ViewMapItems(sim, arena);
-
-  struct ClickBox {
-    Rectangle bounds;
-    simulation::EntityId id;
-  };
-  auto click_boxes = List<ClickBox>(&arena);
-
-  {
-    BeginMode2D(board.camera);
-    auto iter = items.Iterate();
-
-    while (const auto* item = iter.Next()) {
-      auto size = item->size * scale;
-      auto bounds = Rectangle{.x = item->coords.x * scale - size / 2.0f,
-          .y = item->coords.y * scale - size / 2.0f,
-          .width = size / 2.0f,
-          .height = size / 2.0f};
-      auto color = ToRay(item->color);
-      bool is_selected = item->id == selected_id;
-      DrawRectanglePro(bounds, {0.0, 0.0}, 0.0, color);
-
-      // Borders
-      Color border_color = BLACK;
-      if (is_selected) {
-        border_color = YELLOW;
-      }
-      DrawRectangleLinesEx(bounds, 4.0, border_color);
-
-      click_boxes.Push({bounds, item->id});
+static inline void MarkBox(Board& board, render::MapRenderer& renderer,
+    const runner::Snapshot& snapshot, Rectangle world) {
+  std::vector<u32> indices;
+  renderer.Select(world, indices);
+  renderer.Mark(indices);
+
+  // Names come from the snapshot, which the next frame may replace
+  board.marked.clear();
+  auto iter = snapshot.map_items.Iterate();
+  usize index = 0;
+  usize next = 0;
+  while (const auto* item = iter.Next()) {
+    if (next == indices.size()) {
+      break;
+    }
+    if (index == indices[next]) {
+      board.marked.push_back({item->id, item->name});
+      next++;
     }
+    index++;
+  }
+}
 
-    EndMode2D();
+static inline void Draw(Board& board, render::MapRenderer& renderer,
+    const runner::Snapshot& snapshot, simulation::EntityId& selected_id) {
+  renderer.Sync(snapshot, selected_id);
+
+  BeginMode2D(board.camera);
+  renderer.Draw(board.camera);
+  EndMode2D();
+
+  auto mouse = GetMousePosition();
+  bool is_drag = board.dragging &&
+                 Vector2Distance(board.drag_start, mouse) > DRAG_THRESHOLD;
+  Rectangle box = {std::min(board.drag_start.x, mouse.x),
+      std::min(board.drag_start.y, mouse.y),
+      std::abs(mouse.x - board.drag_start.x),
+      std::abs(mouse.y - board.drag_start.y)};
+  if (is_drag) {
+    DrawRectangleRec(box, Fade(ORANGE, 0.2f));
+    DrawRectangleLinesEx(box, 2.0f, ORANGE);
   }
 
   if (IsMouseButtonPressed(MOUSE_LEFT_BUTTON) &&
       !ImGui::GetIO().WantCaptureMouse) {
-    auto screen_pos = GetMousePosition();
-    auto world_pos = GetScreenToWorld2D(screen_pos, board.camera);
-
-    auto iter = click_boxes.Iterate();
-    auto found_id = simulation::EntityId::Null();
-    while (auto* item = iter.Next()) {
-      if (CheckCollisionPointRec(world_pos, item->bounds)) {
-        found_id = item->id;
-      }
+    board.dragging = true;
+    board.drag_start = mouse;
+  }
+  if (board.dragging && IsMouseButtonReleased(MOUSE_LEFT_BUTTON)) {
+    board.dragging = false;
+    if (is_drag) {
+      auto low = GetScreenToWorld2D({box.x, box.y}, board.camera);
+      auto high = GetScreenToWorld2D(
+          {box.x + box.width, box.y + box.height}, board.camera);
+      MarkBox(board, renderer, snapshot,
+          {low.x, low.y, high.x - low.x, high.y - low.y});
+    } else {
+      selected_id = renderer.Pick(GetScreenToWorld2D(mouse, board.camera));
     }
-    selected_id = found_id;
   }
 }
 
@@ -251,9 +391,31 @@ static inline void SetupGui(Gui& gui) {
   style.Colors[ImGuiCol_TitleBgActive] = ToImgui(base);
 }
 
-int main() {
+int main(int argc, char** argv) {
   Arena arena;
 
+  runner::Options options;
+  for (int i = 1; i < argc; ++i) {
+    // Tick on the UI thread in frame-budgeted slices
+    if (std::string_view(argv[i]) == "--inline") {
+      options.threaded = false;
+    }
+    // Start from a save instead of the built-in scenario
+    if (std::string_view(argv[i]) == "--load" && i + 1 < argc) {
+      options.load_path = argv[++i];
+    }
+    // Save in the background every N days
+    if (std::string_view(argv[i]) == "--autosave" && i + 1 < argc) {
+      options.autosave_days = std::strtoull(argv[++i], nullptr, 10);
+    }
+    // Log the session for the headless Replay tool
+    if (std::string_view(argv[i]) == "--record" && i + 1 < argc) {
+      options.record_path = argv[++i];
+    }
+  }
+
+  jobs::Init();
+
   SetConfigFlags(FLAG_VSYNC_HINT);
   InitWindow(1600, 900, "Econ Test");
   rlImGuiSetup(true);
@@ -263,48 +425,76 @@ int main() {
 
   SetTargetFPS(GetMonitorRefreshRate(GetCurrentMonitor()));
 
-  simulation::Sim sim;
-  simulation::Init(sim);
+  runner::Runner runner;
+  runner.Start(options);
 
   Board board;
   BoardInit(board);
+  render::MapRenderer renderer;
+  renderer.Init();
 
   simulation::EntityId selected_id;
+  Outbox outbox;
 
   while (!WindowShouldClose()) {
     arena.Reset();
 
-    if (!selected_id.IsValid()) {
+    runner.Frame();
+    const auto& snapshot = runner.Acquire();
+
+    // Drop selections the sim reports as gone
+    if (snapshot.selected_id == selected_id && !snapshot.selected) {
       selected_id = simulation::EntityId::Null();
     }
+    auto previous_id = selected_id;
 
     // Input
     if (IsKeyPressed(KEY_ESCAPE)) {
       break;
     }
+    MoveCamera(board);
 
     // Draw
     //----------------------------------------------------------------------------------
     BeginDrawing();
     ClearBackground(GRAY);
 
-    Draw(arena, board, sim, selected_id);
+    Draw(board, renderer, snapshot, selected_id);
 
-    DrawGui(gui, sim, arena, selected_id);
+    DrawGui(gui, snapshot, selected_id, board.marked);
 
     EndDrawing();
 
     if (gui.actions.selection.is_changed) {
       selected_id = gui.actions.selection.value;
     }
+    if (gui.actions.clear_marks) {
+      board.marked.clear();
+      renderer.Mark({});
+    }
 
-    // Simulate
-    simulation::TickRequest request;
-    request.advance_time = gui.actions.next_day;
-    simulation::Tick(sim, request);
+    // Forward player input to the sim thread
+    if (!(selected_id == previous_id)) {
+      outbox.Add({.kind = runner::CommandKind::Select, .id = selected_id});
+    }
+    if (gui.actions.next_day) {
+      outbox.Add({.kind = runner::CommandKind::AdvanceDay});
+    }
+    if (gui.actions.speed.is_changed) {
+      outbox.Add({.kind = runner::CommandKind::SetSpeed,
+          .speed = gui.actions.speed.value});
+    }
+    if (gui.actions.save) {
+      outbox.Add({.kind = runner::CommandKind::Save});
+    }
+    outbox.Flush(runner);
   }
 
+  runner.Stop();
+
+  renderer.Unload();
   rlImGuiShutdown();
   CloseWindow();
+  jobs::Shutdown();
   return 0;
 }
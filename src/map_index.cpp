@@ -0,0 +1,137 @@
+#include <map_index.h>
+
+#include <cmath>
+#include <utility>
+
+namespace render {
+
+static const usize TILE_SIZE = 16;
+
+// Interleaves the bits of x and y
+static inline u64 Morton(u32 x, u32 y) {
+  u64 code = 0;
+  for (u32 bit = 0; bit < 32; ++bit) {
+    code |= u64((x >> bit) & 1) << (2 * bit);
+    code |= u64((y >> bit) & 1) << (2 * bit + 1);
+  }
+  return code;
+}
+
+usize MapIndex::KeyOf(usize column, usize row) const {
+  usize tile = (row / TILE_SIZE) * this->tiles_x + column / TILE_SIZE;
+  return this->tile_order[tile] * TILE_SIZE * TILE_SIZE +
+         (row % TILE_SIZE) * TILE_SIZE + column % TILE_SIZE;
+}
+
+usize MapIndex::ColumnOf(f32 x) const {
+  f32 at = (x - this->area.x) / this->cell_size;
+  return at > 0.0f ? std::min(usize(at), this->columns - 1) : 0;
+}
+
+usize MapIndex::RowOf(f32 y) const {
+  f32 at = (y - this->area.y) / this->cell_size;
+  return at > 0.0f ? std::min(usize(at), this->rows - 1) : 0;
+}
+
+void MapIndex::Build(const std::vector<MapItemState>& items) {
+  this->entries.clear();
+  this->bounds.clear();
+  this->cell_start.clear();
+  this->columns = 0;
+  this->rows = 0;
+  if (items.empty()) {
+    return;
+  }
+
+  f32 min_x = items[0].bounds.x;
+  f32 min_y = items[0].bounds.y;
+  f32 max_x = min_x;
+  f32 max_y = min_y;
+  this->reach_x = 0.0f;
+  this->reach_y = 0.0f;
+  for (const auto& item : items) {
+    const auto& r = item.bounds;
+    min_x = std::min(min_x, r.x);
+    min_y = std::min(min_y, r.y);
+    max_x = std::max(max_x, r.x + r.width);
+    max_y = std::max(max_y, r.y + r.height);
+    this->reach_x = std::max(this->reach_x, r.width / 2.0f);
+    this->reach_y = std::max(this->reach_y, r.height / 2.0f);
+  }
+  this->area = {min_x, min_y, max_x - min_x, max_y - min_y};
+
+  // About four items to a cell, and no cell smaller than an item
+  usize count = items.size();
+  f32 side = 2.0f * std::sqrt(std::max(this->area.width * this->area.height, 1.0f) /
+                              f32(count));
+  this->cell_size =
+      std::max({side, 2.0f * this->reach_x, 2.0f * this->reach_y, 1.0f});
+  // Sparse maps could still ask for far more cells than items
+  while (true) {
+    this->columns = usize(this->area.width / this->cell_size) + 1;
+    this->rows = usize(this->area.height / this->cell_size) + 1;
+    if (this->columns * this->rows <= 4 * count + 16) {
+      break;
+    }
+    this->cell_size *= 2.0f;
+  }
+  this->tiles_x = (this->columns + TILE_SIZE - 1) / TILE_SIZE;
+  usize tiles_y = (this->rows + TILE_SIZE - 1) / TILE_SIZE;
+  usize num_tiles = this->tiles_x * tiles_y;
+  usize num_keys = num_tiles * TILE_SIZE * TILE_SIZE;
+
+  // Tiles go in Z order, so a run of them covers a compact patch
+  std::vector<std::pair<u64, u32>> codes(num_tiles);
+  for (usize tile = 0; tile < num_tiles; ++tile) {
+    codes[tile] = {Morton(u32(tile % this->tiles_x), u32(tile / this->tiles_x)),
+        u32(tile)};
+  }
+  std::sort(codes.begin(), codes.end());
+  this->tile_order.resize(num_tiles);
+  for (usize rank = 0; rank < num_tiles; ++rank) {
+    this->tile_order[codes[rank].second] = u32(rank);
+  }
+
+  // Counting sort of the items by the key of their center's cell
+  std::vector<u32> keys(count);
+  this->cell_start.assign(num_keys + 1, 0);
+  for (usize i = 0; i < count; ++i) {
+    const auto& r = items[i].bounds;
+    usize key = this->KeyOf(this->ColumnOf(r.x + r.width / 2.0f),
+        this->RowOf(r.y + r.height / 2.0f));
+    keys[i] = u32(key);
+    this->cell_start[key + 1]++;
+  }
+  for (usize key = 0; key < num_keys; ++key) {
+    this->cell_start[key + 1] += this->cell_start[key];
+  }
+  std::vector<u32> next(this->cell_start.begin(), this->cell_start.end() - 1);
+  this->entries.resize(count);
+  this->bounds.resize(count);
+  for (usize i = 0; i < count; ++i) {
+    u32 slot = next[keys[i]]++;
+    this->entries[slot] = u32(i);
+    this->bounds[slot] = items[i].bounds;
+  }
+}
+
+std::optional<u32> MapIndex::Pick(Vector2 point) const {
+  std::optional<u32> top;
+  this->Query({point.x, point.y, 0.0f, 0.0f}, [&](u32 slot, u32) {
+    if (!top || slot > *top) {
+      top = slot;
+    }
+  });
+  if (top) {
+    return this->entries[*top];
+  }
+  return top;
+}
+
+void MapIndex::Select(Rectangle query, std::vector<u32>& out) const {
+  out.clear();
+  this->Query(query, [&](u32, u32 index) { out.push_back(index); });
+  std::sort(out.begin(), out.end());
+}
+
+} // namespace render
@@ -0,0 +1,398 @@
+#include <map_render.h>
+
+#include <cmath>
+#include <cstring>
+#include <utility>
+
+#include <raymath.h>
+#include <rlgl.h>
+
+namespace render {
+
+// Items per mesh. Meshes are drawn without indices, so the 16-bit index
+// limit does not apply; this only bounds the size of one upload.
+static const usize ITEMS_PER_CHUNK = 4096;
+// Border quad, then fill quad, two triangles each
+static const usize VERTICES_PER_ITEM = 12;
+// Inside the depth range BeginMode2D sets up
+static const f32 MAP_DEPTH = -0.5f;
+// Each cluster level is this many times wider than the one below
+static const f32 LEVEL_STEP = 4.0f;
+static const usize MAX_LEVELS = 8;
+
+static inline bool operator==(const Color& a, const Color& b) {
+  return a.r == b.r && a.g == b.g && a.b == b.b && a.a == b.a;
+}
+
+static inline bool operator==(const Rectangle& a, const Rectangle& b) {
+  return a.x == b.x && a.y == b.y && a.width == b.width && a.height == b.height;
+}
+
+static inline Color ToRay(simulation::RGB color) {
+  return Color{.r = color.r, .g = color.g, .b = color.b, .a = 255};
+}
+
+// Same placement as the immediate-mode map drawing had
+static inline Rectangle BoundsOf(const simulation::MapItem& item) {
+  f32 size = item.size * MAP_SCALE;
+  return Rectangle{.x = item.coords.x * MAP_SCALE - size / 2.0f,
+      .y = item.coords.y * MAP_SCALE - size / 2.0f,
+      .width = size / 2.0f,
+      .height = size / 2.0f};
+}
+
+// Two triangles in the winding rlgl draws its own quads with
+static inline f32* WriteQuad(f32* out, Rectangle r) {
+  const f32 corners[6][2] = {
+      {r.x, r.y},
+      {r.x, r.y + r.height},
+      {r.x + r.width, r.y + r.height},
+      {r.x, r.y},
+      {r.x + r.width, r.y + r.height},
+      {r.x + r.width, r.y},
+  };
+  for (const auto& corner : corners) {
+    *out++ = corner[0];
+    *out++ = corner[1];
+    *out++ = MAP_DEPTH;
+  }
+  return out;
+}
+
+MapRenderer::~MapRenderer() { this->Unload(); }
+
+void MapRenderer::Init() {
+  this->material = LoadMaterialDefault();
+  this->loaded = true;
+}
+
+void MapRenderer::Unload() {
+  FreeChunks(this->chunks);
+  for (auto& level : this->levels) {
+    FreeChunks(level.chunks);
+  }
+  this->levels.clear();
+  this->items.clear();
+  this->index.Build(this->items);
+  if (this->loaded) {
+    UnloadMaterial(this->material);
+    this->loaded = false;
+  }
+}
+
+void MapRenderer::AllocateChunks(std::vector<Chunk>& chunks, usize num_items) {
+  for (usize first = 0; first < num_items; first += ITEMS_PER_CHUNK) {
+    Chunk chunk;
+    chunk.first = first;
+    chunk.num_items = std::min(ITEMS_PER_CHUNK, num_items - first);
+    usize num_vertices = chunk.num_items * VERTICES_PER_ITEM;
+    chunk.mesh.vertexCount = int(num_vertices);
+    chunk.mesh.triangleCount = int(num_vertices / 3);
+    chunk.mesh.vertices = (f32*)MemAlloc(num_vertices * 3 * sizeof(f32));
+    chunk.mesh.colors = (unsigned char*)MemAlloc(num_vertices * 4);
+    chunks.push_back(chunk);
+  }
+}
+
+void MapRenderer::FreeChunks(std::vector<Chunk>& chunks) {
+  for (auto& chunk : chunks) {
+    if (chunk.uploaded) {
+      // Frees the CPU copies too
+      UnloadMesh(chunk.mesh);
+    } else {
+      MemFree(chunk.mesh.vertices);
+      MemFree(chunk.mesh.colors);
+    }
+  }
+  chunks.clear();
+}
+
+void MapRenderer::WritePositions(Chunk& chunk, usize local, Rectangle bounds) {
+  f32* out = chunk.mesh.vertices + local * VERTICES_PER_ITEM * 3;
+  out = WriteQuad(out, bounds);
+
+  // Too small for an inset: the border covers it all, as with
+  // DrawRectangleLinesEx
+  Rectangle fill = bounds;
+  fill.x += BORDER_WIDTH;
+  fill.y += BORDER_WIDTH;
+  fill.width = std::max(0.0f, fill.width - 2.0f * BORDER_WIDTH);
+  fill.height = std::max(0.0f, fill.height - 2.0f * BORDER_WIDTH);
+  WriteQuad(out, fill);
+  chunk.positions.Add(local);
+  chunk.low = Vector2Min(chunk.low, {bounds.x, bounds.y});
+  chunk.high =
+      Vector2Max(chunk.high, {bounds.x + bounds.width, bounds.y + bounds.height});
+}
+
+void MapRenderer::WriteColors(Chunk& chunk, usize local, Color border, Color fill) {
+  auto* out = chunk.mesh.colors + local * VERTICES_PER_ITEM * 4;
+  for (usize vertex = 0; vertex < VERTICES_PER_ITEM; ++vertex) {
+    const Color& color = vertex < VERTICES_PER_ITEM / 2 ? border : fill;
+    std::memcpy(out + vertex * 4, &color, 4);
+  }
+  chunk.colors.Add(local);
+}
+
+void MapRenderer::Upload(Chunk& chunk) {
+  if (!chunk.uploaded) {
+    UploadMesh(&chunk.mesh, true);
+    chunk.uploaded = true;
+  } else {
+    usize vertex_size = VERTICES_PER_ITEM * 3 * sizeof(f32);
+    if (!chunk.positions.IsEmpty()) {
+      usize begin = chunk.positions.begin * vertex_size;
+      UpdateMeshBuffer(chunk.mesh, RL_DEFAULT_SHADER_ATTRIB_LOCATION_POSITION,
+          (byte*)chunk.mesh.vertices + begin,
+          int((chunk.positions.end - chunk.positions.begin) * vertex_size),
+          int(begin));
+    }
+    usize color_size = VERTICES_PER_ITEM * 4;
+    if (!chunk.colors.IsEmpty()) {
+      usize begin = chunk.colors.begin * color_size;
+      UpdateMeshBuffer(chunk.mesh, RL_DEFAULT_SHADER_ATTRIB_LOCATION_COLOR,
+          chunk.mesh.colors + begin,
+          int((chunk.colors.end - chunk.colors.begin) * color_size), int(begin));
+    }
+  }
+  chunk.positions = {};
+  chunk.colors = {};
+}
+
+// Indexes the current bounds, lays out new chunks in slot order and sets
+// up empty cluster levels. The caller writes every item afterwards.
+void MapRenderer::Layout() {
+  FreeChunks(this->chunks);
+  this->index.Build(this->items);
+  const auto& entries = this->index.Entries();
+  this->slot_of.resize(entries.size());
+  for (usize slot = 0; slot < entries.size(); ++slot) {
+    this->slot_of[entries[slot]] = u32(slot);
+  }
+  AllocateChunks(this->chunks, this->items.size());
+
+  for (auto& level : this->levels) {
+    FreeChunks(level.chunks);
+  }
+  this->levels.clear();
+  if (this->items.empty()) {
+    return;
+  }
+  Rectangle area = this->index.Area();
+  this->pitch = std::max(std::sqrt(area.width * area.height / f32(this->items.size())),
+      this->items[0].bounds.width);
+  // Coarsen until a single cell covers the whole map
+  f32 cell_size = this->pitch;
+  while (this->levels.size() < MAX_LEVELS) {
+    cell_size *= LEVEL_STEP;
+    this->levels.push_back({.cell_size = cell_size});
+    if (cell_size >= std::max(area.width, area.height)) {
+      break;
+    }
+  }
+}
+
+void MapRenderer::WriteItem(usize item, bool positions) {
+  usize slot = this->slot_of[item];
+  auto& chunk = this->chunks[slot / ITEMS_PER_CHUNK];
+  usize local = slot - chunk.first;
+  const auto& state = this->items[item];
+  if (positions) {
+    WritePositions(chunk, local, state.bounds);
+  }
+  WriteColors(chunk, local, state.border, state.fill);
+}
+
+// One quad per occupied cell, over the items centered in it and colored
+// as the owner of most of them
+void MapRenderer::BuildLevel(Level& level) {
+  FreeChunks(level.chunks);
+  Rectangle area = this->index.Area();
+  usize columns = usize(area.width / level.cell_size) + 1;
+
+  // Sorted by cell, then owner, each cell's owners form runs
+  std::vector<std::pair<u64, u32>> keys(this->items.size());
+  for (usize i = 0; i < this->items.size(); ++i) {
+    const auto& item = this->items[i];
+    f32 x = item.bounds.x + item.bounds.width / 2.0f - area.x;
+    f32 y = item.bounds.y + item.bounds.height / 2.0f - area.y;
+    u64 cell = usize(std::max(0.0f, y / level.cell_size)) * columns +
+               usize(std::max(0.0f, x / level.cell_size));
+    keys[i] = {(cell << 32) | item.owner, u32(i)};
+  }
+  std::sort(keys.begin(), keys.end());
+
+  std::vector<MapItemState> clusters;
+  for (usize begin = 0; begin < keys.size();) {
+    u64 cell = keys[begin].first >> 32;
+    Vector2 low{INFINITY, INFINITY};
+    Vector2 high{-INFINITY, -INFINITY};
+    usize best = begin;
+    usize best_count = 0;
+    usize end = begin;
+    while (end < keys.size() && keys[end].first >> 32 == cell) {
+      usize run = end;
+      while (end < keys.size() && keys[end].first == keys[run].first) {
+        const auto& bounds = this->items[keys[end].second].bounds;
+        low = Vector2Min(low, {bounds.x, bounds.y});
+        high = Vector2Max(high, {bounds.x + bounds.width, bounds.y + bounds.height});
+        end++;
+      }
+      if (end - run > best_count) {
+        best = run;
+        best_count = end - run;
+      }
+    }
+    Color fill = this->items[keys[best].second].fill;
+    clusters.push_back({
+        .bounds = {low.x, low.y, high.x - low.x, high.y - low.y},
+        .fill = fill,
+        .border = fill,
+    });
+    begin = end;
+  }
+
+  AllocateChunks(level.chunks, clusters.size());
+  for (usize i = 0; i < clusters.size(); ++i) {
+    auto& chunk = level.chunks[i / ITEMS_PER_CHUNK];
+    WritePositions(chunk, i - chunk.first, clusters[i].bounds);
+    WriteColors(chunk, i - chunk.first, clusters[i].border, clusters[i].fill);
+  }
+  for (auto& chunk : level.chunks) {
+    Upload(chunk);
+  }
+  level.built = true;
+}
+
+usize MapRenderer::LevelFor(f32 zoom) const {
+  if (this->pitch * zoom >= LOD_PIXELS) {
+    return 0;
+  }
+  for (usize i = 0; i < this->levels.size(); ++i) {
+    if (this->levels[i].cell_size * zoom >= LOD_PIXELS) {
+      return i + 1;
+    }
+  }
+  return this->levels.size();
+}
+
+void MapRenderer::Sync(
+    const runner::Snapshot& snapshot, simulation::EntityId selected_id) {
+  if (snapshot.sequence == this->sequence && selected_id == this->selected_id &&
+      !this->stale) {
+    return;
+  }
+  this->sequence = snapshot.sequence;
+  this->selected_id = selected_id;
+  this->stale = false;
+
+  const auto& map_items = snapshot.map_items;
+  bool moved = map_items.Length() != this->items.size();
+  if (moved) {
+    this->items.assign(map_items.Length(), {});
+    this->marked.assign(map_items.Length(), false);
+  }
+
+  // Colors are written as they are found, unless something moved and
+  // everything is written after the layout anyway
+  auto iter = map_items.Iterate();
+  usize index = 0;
+  while (const auto* item = iter.Next()) {
+    auto& state = this->items[index];
+    Rectangle bounds = BoundsOf(*item);
+    Color fill = ToRay(item->color);
+    Color border = item->id == selected_id ? YELLOW
+                   : this->marked[index]   ? ORANGE
+                                           : BLACK;
+    state.id = item->id;
+    state.owner = item->owner;
+    if (!(bounds == state.bounds)) {
+      state.bounds = bounds;
+      moved = true;
+    }
+    if (!(fill == state.fill) || !(border == state.border)) {
+      state.fill = fill;
+      state.border = border;
+      if (!moved) {
+        this->WriteItem(index, false);
+      }
+    }
+    index++;
+  }
+
+  if (moved) {
+    this->Layout();
+    for (usize item = 0; item < this->items.size(); ++item) {
+      this->WriteItem(item, true);
+    }
+  } else if (snapshot.owners_version != this->owners_version) {
+    for (auto& level : this->levels) {
+      level.built = false;
+    }
+  }
+  this->owners_version = snapshot.owners_version;
+
+  for (auto& chunk : this->chunks) {
+    if (!chunk.uploaded || !chunk.positions.IsEmpty() || !chunk.colors.IsEmpty()) {
+      Upload(chunk);
+    }
+  }
+}
+
+void MapRenderer::Draw(const Camera2D& camera) {
+  // World rectangle under the screen
+  Vector2 corners[4] = {
+      GetScreenToWorld2D({0.0f, 0.0f}, camera),
+      GetScreenToWorld2D({f32(GetScreenWidth()), 0.0f}, camera),
+      GetScreenToWorld2D({0.0f, f32(GetScreenHeight())}, camera),
+      GetScreenToWorld2D({f32(GetScreenWidth()), f32(GetScreenHeight())}, camera),
+  };
+  Vector2 low = corners[0];
+  Vector2 high = corners[0];
+  for (const auto& corner : corners) {
+    low = Vector2Min(low, corner);
+    high = Vector2Max(high, corner);
+  }
+
+  this->drawn_level = this->LevelFor(camera.zoom);
+  const auto* chunks = &this->chunks;
+  if (this->drawn_level > 0) {
+    auto& level = this->levels[this->drawn_level - 1];
+    if (!level.built) {
+      this->BuildLevel(level);
+    }
+    chunks = &level.chunks;
+  }
+
+  // Anything still queued in rlgl's own batch goes first
+  rlDrawRenderBatchActive();
+  for (const auto& chunk : *chunks) {
+    if (chunk.low.x <= high.x && low.x <= chunk.high.x && chunk.low.y <= high.y &&
+        low.y <= chunk.high.y) {
+      DrawMesh(chunk.mesh, this->material, MatrixIdentity());
+    }
+  }
+}
+
+simulation::EntityId MapRenderer::Pick(Vector2 world) const {
+  if (auto item = this->index.Pick(world)) {
+    return this->items[*item].id;
+  }
+  return simulation::EntityId::Null();
+}
+
+void MapRenderer::Select(Rectangle world, std::vector<u32>& out) const {
+  this->index.Select(world, out);
+}
+
+void MapRenderer::Mark(const std::vector<u32>& indices) {
+  std::fill(this->marked.begin(), this->marked.end(), false);
+  for (u32 item : indices) {
+    if (item < this->marked.size()) {
+      this->marked[item] = true;
+    }
+  }
+  this->stale = true;
+}
+
+} // namespace render
@@ -0,0 +1,257 @@
+#include <paths.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <queue>
+#include <utility>
+
+#include <trade.h>
+
+namespace simulation {
+
+static const f64 INF = std::numeric_limits<f64>::infinity();
+// Edges within this of a shortest path are treated as part of it
+static const f64 TIGHT_EPSILON = 1e-9;
+
+using Entry = std::pair<f64, u32>;
+using MinQueue =
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>>;
+
+static inline u64 CacheKey(u32 from, u32 to) {
+  // Edges are undirected, so the cost is symmetric
+  if (from > to) {
+    std::swap(from, to);
+  }
+  return (u64(from) << 32) | u64(to);
+}
+
+PathService::CacheShard& PathService::ShardOf(u64 key) {
+  // Both halves of the key are slots, so mix them before picking a shard
+  u64 hash = key * 0x9E3779B97F4A7C15ull;
+  return this->cache[(hash >> 32) % CACHE_SHARDS];
+}
+
+void PathService::ClearCache() {
+  for (auto& shard : this->cache) {
+    std::lock_guard lock(shard.mutex);
+    shard.entries.clear();
+  }
+}
+
+void PathService::ComputeLandmark(usize landmark) {
+  const auto& graph = *this->graph;
+  f64* dist = &this->landmark_dist[landmark * this->num_nodes];
+  std::fill(dist, dist + this->num_nodes, INF);
+
+  MinQueue queue;
+  u32 source = this->landmarks[landmark];
+  dist[source] = 0.0;
+  queue.push({0.0, source});
+  while (!queue.empty()) {
+    auto [d, node] = queue.top();
+    queue.pop();
+    if (d > dist[node]) {
+      continue;
+    }
+    auto targets = graph.Targets(node);
+    auto costs = graph.Costs(node);
+    for (usize i = 0; i < targets.size(); ++i) {
+      f64 next = d + costs[i];
+      if (next < dist[targets[i]]) {
+        dist[targets[i]] = next;
+        queue.push({next, targets[i]});
+      }
+    }
+  }
+}
+
+// Farthest-point selection over connected nodes. Nodes no landmark reaches
+// count as farthest, so every component gets covered first.
+void PathService::PickLandmarks() {
+  const auto& graph = *this->graph;
+  this->landmarks.clear();
+
+  std::vector<f64> nearest(this->num_nodes, INF);
+  for (usize i = 0; i < this->max_landmarks; ++i) {
+    u32 best = LocationGraph::NIL;
+    f64 best_dist = -1.0;
+    for (u32 node = 0; node < this->num_nodes; ++node) {
+      if (graph.Targets(node).empty() || nearest[node] == 0.0) {
+        continue;
+      }
+      if (nearest[node] > best_dist) {
+        best = node;
+        best_dist = nearest[node];
+      }
+    }
+    if (best == LocationGraph::NIL) {
+      break;
+    }
+
+    this->landmarks.push_back(best);
+    this->landmark_dist.resize(this->landmarks.size() * this->num_nodes);
+    this->ComputeLandmark(this->landmarks.size() - 1);
+    const f64* dist = &this->landmark_dist[i * this->num_nodes];
+    for (u32 node = 0; node < this->num_nodes; ++node) {
+      nearest[node] = std::min(nearest[node], dist[node]);
+    }
+  }
+}
+
+void PathService::Sync(const LocationGraph& graph) {
+  if (this->graph == &graph && this->graph_version == graph.Version()) {
+    return;
+  }
+  this->graph = &graph;
+  this->graph_version = graph.Version();
+  this->num_nodes = graph.NumNodes();
+  this->landmark_dist.clear();
+  this->PickLandmarks();
+  this->ClearCache();
+}
+
+// Triangle inequality: |d(L, from) - d(L, to)| <= d(from, to) for every
+// landmark L that reaches both
+f64 PathService::LowerBound(u32 from, u32 to) const {
+  f64 bound = 0.0;
+  for (usize i = 0; i < this->landmarks.size(); ++i) {
+    const f64* dist = &this->landmark_dist[i * this->num_nodes];
+    if (dist[from] == INF || dist[to] == INF) {
+      continue;
+    }
+    bound = std::max(bound, std::abs(dist[from] - dist[to]));
+  }
+  return bound;
+}
+
+f64 PathService::Distance(u32 from, u32 to) {
+  assert(this->graph);
+  const auto& graph = *this->graph;
+  if (from == to) {
+    return 0.0;
+  }
+  if (graph.ComponentOf(from) != graph.ComponentOf(to)) {
+    return INF;
+  }
+
+  u64 key = CacheKey(from, to);
+  auto& shard = this->ShardOf(key);
+  {
+    std::lock_guard lock(shard.mutex);
+    auto it = shard.entries.find(key);
+    if (it != shard.entries.end()) {
+      return it->second;
+    }
+  }
+
+  // Per calling thread, since callers need not be pool workers. Every
+  // entry is left at infinity after a search, whichever service ran it.
+  struct Scratch {
+    std::vector<f64> dist;
+    std::vector<u32> touched;
+  };
+  static thread_local Scratch scratch;
+  if (scratch.dist.size() < this->num_nodes) {
+    scratch.dist.resize(this->num_nodes, INF);
+  }
+
+  // A* with the landmark bound as heuristic
+  auto& dist = scratch.dist;
+  MinQueue queue;
+  dist[from] = 0.0;
+  scratch.touched.push_back(from);
+  queue.push({this->LowerBound(from, to), from});
+
+  f64 result = INF;
+  while (!queue.empty()) {
+    auto [estimate, node] = queue.top();
+    queue.pop();
+    if (node == to) {
+      result = dist[node];
+      break;
+    }
+    f64 d = dist[node];
+    if (estimate > d + this->LowerBound(node, to) + TIGHT_EPSILON) {
+      continue;
+    }
+    auto targets = graph.Targets(node);
+    auto costs = graph.Costs(node);
+    for (usize i = 0; i < targets.size(); ++i) {
+      u32 next = targets[i];
+      f64 next_dist = d + costs[i];
+      if (next_dist < dist[next]) {
+        if (dist[next] == INF) {
+          scratch.touched.push_back(next);
+        }
+        dist[next] = next_dist;
+        queue.push({next_dist + this->LowerBound(next, to), next});
+      }
+    }
+  }
+
+  for (u32 node : scratch.touched) {
+    dist[node] = INF;
+  }
+  scratch.touched.clear();
+
+  std::lock_guard lock(shard.mutex);
+  if (shard.entries.size() >= CACHE_SHARD_CAPACITY) {
+    shard.entries.clear();
+  }
+  shard.entries[key] = result;
+  return result;
+}
+
+// Dijkstra restricted to the nodes whose distance improves from `node`
+void PathService::Relax(usize landmark, u32 node) {
+  const auto& graph = *this->graph;
+  f64* dist = &this->landmark_dist[landmark * this->num_nodes];
+  MinQueue queue;
+  queue.push({dist[node], node});
+  while (!queue.empty()) {
+    auto [d, current] = queue.top();
+    queue.pop();
+    if (d > dist[current]) {
+      continue;
+    }
+    auto targets = graph.Targets(current);
+    auto costs = graph.Costs(current);
+    for (usize i = 0; i < targets.size(); ++i) {
+      f64 next = d + costs[i];
+      if (next < dist[targets[i]]) {
+        dist[targets[i]] = next;
+        queue.push({next, targets[i]});
+      }
+    }
+  }
+}
+
+void PathService::OnCostChanged(u32 a, u32 b, f64 old_cost, f64 new_cost) {
+  if (!this->graph || old_cost == new_cost) {
+    return;
+  }
+  for (usize i = 0; i < this->landmarks.size(); ++i) {
+    f64* dist = &this->landmark_dist[i * this->num_nodes];
+    if (new_cost < old_cost) {
+      if (dist[a] + new_cost < dist[b]) {
+        dist[b] = dist[a] + new_cost;
+        this->Relax(i, b);
+      } else if (dist[b] + new_cost < dist[a]) {
+        dist[a] = dist[b] + new_cost;
+        this->Relax(i, a);
+      }
+    } else {
+      bool tight = std::abs(dist[a] + old_cost - dist[b]) <= TIGHT_EPSILON ||
+                   std::abs(dist[b] + old_cost - dist[a]) <= TIGHT_EPSILON;
+      if (tight) {
+        this->ComputeLandmark(i);
+      }
+    }
+  }
+
+  this->ClearCache();
+}
+
+} // namespace simulation
@@ -0,0 +1,201 @@
+#include <recording.h>
+
+#include <cassert>
+#include <cstring>
+#include <iostream>
+
+#include <jobs.h>
+#include <runner.h>
+
+namespace runner {
+using namespace simulation;
+
+static const char RECORDING_MAGIC[8] = {'E', 'C', 'O', 'N', 'R', 'E', 'C', 'S'};
+static const u32 RECORDING_VERSION = 2;
+
+struct RecordingHeader {
+  char magic[8];
+  u32 version{0};
+  RecordingStart start{RecordingStart::Scenario};
+  u64 seed{0};
+  u32 num_threads{0};
+  // Followed by the load path, without terminator
+  u32 path_length{0};
+};
+
+enum class EntryKind : u8 {
+  Command = 1,
+  End,
+  // State digest after the tick
+  Digest,
+};
+
+struct Entry {
+  u64 tick{0};
+  // Entity generation for commands, the digest for digests
+  u64 value{0};
+  u32 id_slot{0};
+  EntryKind entry{EntryKind::Command};
+  u8 kind{0};
+  u8 speed{0};
+  u8 id_kind{0};
+};
+
+static inline u32 SlotOf(const Sim& sim, EntityId id) {
+  switch (id.kind) {
+  case EntityIdKind::Location:
+    return sim.locations.IndexOf(*(const Location*)id.handle);
+  case EntityIdKind::Building:
+    return sim.buildings.IndexOf(*(const Building*)id.handle);
+  case EntityIdKind::Pop:
+    return sim.pops.IndexOf(*(const Pop*)id.handle);
+  case EntityIdKind::INVALID:
+    break;
+  }
+  return 0;
+}
+
+Recorder::~Recorder() {
+  if (this->file) {
+    std::fclose(this->file);
+  }
+}
+
+bool Recorder::Open(const char* path, const Sim& sim, const char* load_path) {
+  assert(!this->file);
+  this->file = std::fopen(path, "wb");
+  if (!this->file) {
+    std::cout << "Could not open recording '" << path << "'" << std::endl;
+    return false;
+  }
+  RecordingHeader header{
+      .version = RECORDING_VERSION,
+      .start = load_path ? RecordingStart::Save : RecordingStart::Scenario,
+      .seed = sim.seed,
+      .num_threads = u32(jobs::NumThreads()),
+      .path_length = load_path ? u32(std::strlen(load_path)) : 0,
+  };
+  std::memcpy(header.magic, RECORDING_MAGIC, sizeof(RECORDING_MAGIC));
+  std::fwrite(&header, sizeof(header), 1, this->file);
+  std::fwrite(load_path, 1, header.path_length, this->file);
+  return true;
+}
+
+void Recorder::Record(const Sim& sim, u64 tick, const Command& command) {
+  if (!this->file) {
+    return;
+  }
+  Entry entry{
+      .tick = tick,
+      .entry = EntryKind::Command,
+      .kind = u8(command.kind),
+      .speed = u8(command.speed),
+      .id_kind = u8(command.id.kind),
+  };
+  // Stale handles still name a slot; the replay finds them stale too
+  if (command.id.handle) {
+    entry.id_slot = SlotOf(sim, command.id);
+    entry.value = command.id.generation;
+  }
+  std::fwrite(&entry, sizeof(entry), 1, this->file);
+}
+
+void Recorder::RecordDigest(u64 tick, u64 digest) {
+  if (!this->file) {
+    return;
+  }
+  Entry entry{.tick = tick, .value = digest, .entry = EntryKind::Digest};
+  std::fwrite(&entry, sizeof(entry), 1, this->file);
+}
+
+void Recorder::Close(u64 ticks) {
+  if (!this->file) {
+    return;
+  }
+  Entry entry{.tick = ticks, .entry = EntryKind::End};
+  std::fwrite(&entry, sizeof(entry), 1, this->file);
+  std::fclose(this->file);
+  this->file = nullptr;
+}
+
+bool ReadRecording(const char* path, Recording& recording) {
+  FILE* file = std::fopen(path, "rb");
+  if (!file) {
+    std::cout << "Could not open recording '" << path << "'" << std::endl;
+    return false;
+  }
+  RecordingHeader header;
+  bool ok = std::fread(&header, sizeof(header), 1, file) == 1 &&
+            std::memcmp(header.magic, RECORDING_MAGIC, sizeof(RECORDING_MAGIC)) ==
+                0 &&
+            header.version == RECORDING_VERSION;
+  if (ok) {
+    recording.start = header.start;
+    recording.seed = header.seed;
+    recording.num_threads = header.num_threads;
+    recording.load_path.resize(header.path_length);
+    ok = std::fread(recording.load_path.data(), 1, header.path_length, file) ==
+         header.path_length;
+  }
+
+  Entry entry;
+  while (ok && std::fread(&entry, sizeof(entry), 1, file) == 1) {
+    if (entry.entry == EntryKind::End) {
+      recording.ticks = entry.tick;
+      recording.complete = true;
+      break;
+    }
+    if (entry.entry == EntryKind::Digest) {
+      // One per tick, in order
+      if (entry.tick != recording.digests.size() + 1) {
+        ok = false;
+        break;
+      }
+      recording.digests.push_back(entry.value);
+      recording.ticks = entry.tick;
+      continue;
+    }
+    recording.commands.push_back({
+        .tick = entry.tick,
+        .kind = CommandKind(entry.kind),
+        .speed = Speed(entry.speed),
+        .id_kind = EntityIdKind(entry.id_kind),
+        .id_slot = entry.id_slot,
+        .id_generation = entry.value,
+    });
+    recording.ticks = entry.tick;
+  }
+  std::fclose(file);
+  if (!ok) {
+    std::cout << "Recording '" << path << "' is invalid" << std::endl;
+  }
+  return ok;
+}
+
+EntityId ToEntityId(const Sim& sim, const RecordedCommand& command) {
+  auto in_range = [&](usize capacity) { return command.id_slot < capacity; };
+  switch (command.id_kind) {
+  case EntityIdKind::Location:
+    if (in_range(sim.locations.Capacity())) {
+      return {command.id_kind, &sim.locations[command.id_slot],
+          command.id_generation};
+    }
+    break;
+  case EntityIdKind::Building:
+    if (in_range(sim.buildings.Capacity())) {
+      return {command.id_kind, &sim.buildings[command.id_slot],
+          command.id_generation};
+    }
+    break;
+  case EntityIdKind::Pop:
+    if (in_range(sim.pops.Capacity())) {
+      return {command.id_kind, &sim.pops[command.id_slot], command.id_generation};
+    }
+    break;
+  case EntityIdKind::INVALID:
+    break;
+  }
+  return EntityId::Null();
+}
+
+} // namespace runner
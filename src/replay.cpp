@@ -0,0 +1,276 @@
+// Headless replay of a session recorded with Main --record. Reruns the same
+// ticks from the same starting world and reports how long each one took.
+// The state is checked against the digests in the recording after every
+// tick, and with --verify against a second run made after the timed one.
+#include <core.h>
+#include <digest.h>
+#include <jobs.h>
+#include <ledger.h>
+#include <recording.h>
+#include <runner.h>
+#include <save.h>
+#include <simulation.h>
+#include <stats_export.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string_view>
+#include <vector>
+
+using namespace simulation;
+using Clock = std::chrono::steady_clock;
+using Millis = std::chrono::duration<f64, std::milli>;
+
+// How many of the slowest ticks to list
+static const usize NUM_SLOWEST = 5;
+
+static inline f64 Percentile(const std::vector<f64>& sorted, f64 p) {
+  if (sorted.empty()) {
+    return 0.0;
+  }
+  usize index = usize(p * f64(sorted.size() - 1) + 0.5);
+  return sorted[std::min(index, sorted.size() - 1)];
+}
+
+static bool InitFrom(Sim& sim, const runner::Recording& recording) {
+  InitEmpty(sim);
+  if (recording.start == runner::RecordingStart::Save) {
+    return LoadSim(sim, recording.load_path.c_str());
+  }
+  sim.seed = recording.seed;
+  InitScenario(sim);
+  return true;
+}
+
+// The worker pool is process wide; runs with different thread counts take
+// turns with it
+static inline void UsePool(usize num_threads) {
+  if (jobs::NumThreads() != num_threads) {
+    jobs::Shutdown();
+    jobs::Init(num_threads);
+  }
+}
+
+int main(int argc, char** argv) {
+  const char* log_path = nullptr;
+  const char* csv_path = nullptr;
+  const char* stats_path = nullptr;
+  usize num_threads = 0;
+  bool threads_given = false;
+  usize verify_threads = 0;
+  bool verify = false;
+  for (int i = 1; i < argc; ++i) {
+    // Worker count; defaults to the one the session was recorded with
+    if (std::string_view(argv[i]) == "--threads" && i + 1 < argc) {
+      num_threads = std::strtoull(argv[++i], nullptr, 10);
+      threads_given = true;
+    } else if (std::string_view(argv[i]) == "--verify" && i + 1 < argc) {
+      // Second run on this many threads, compared entity by entity
+      verify_threads = std::strtoull(argv[++i], nullptr, 10);
+      verify = true;
+    } else if (std::string_view(argv[i]) == "--stats" && i + 1 < argc) {
+      // Per-tick statistics export, see stats_export.h
+      stats_path = argv[++i];
+    } else if (std::string_view(argv[i]) == "--csv" && i + 1 < argc) {
+      // Per-tick timings as tick,ms
+      csv_path = argv[++i];
+    } else {
+      log_path = argv[i];
+    }
+  }
+  if (!log_path) {
+    std::cout << "Usage: Replay <recording> [--threads N] [--verify N] "
+                 "[--stats out.stats] [--csv timings.csv]"
+              << std::endl;
+    return 1;
+  }
+
+  runner::Recording recording;
+  if (!runner::ReadRecording(log_path, recording)) {
+    return 1;
+  }
+  if (!recording.complete) {
+    std::cout << "Recording did not end cleanly; replaying up to tick "
+              << recording.ticks << std::endl;
+  }
+
+  jobs::Init(threads_given ? num_threads : recording.num_threads);
+  num_threads = jobs::NumThreads();
+  if (verify && verify_threads == 0) {
+    verify_threads = num_threads;
+  }
+
+  // Per-thread buffers are sized at init, so each sim is built on the pool
+  // it ticks on
+  Sim sim;
+  bool ok = InitFrom(sim, recording);
+  if (!ok) {
+    jobs::Shutdown();
+    return 1;
+  }
+
+  StatsExport stats;
+  if (stats_path && !stats.Open(stats_path, sim)) {
+    jobs::Shutdown();
+    return 1;
+  }
+
+  StateHasher hasher;
+  // Digest after every tick, for the verify run to compare against
+  std::vector<Digest> digests;
+  bool check_digests = !recording.digests.empty();
+  // Ticks after which the state first differed; 0 while it has not
+  u64 recorded_mismatch = 0;
+  u64 diverged = 0;
+  Divergence divergence;
+
+  TickRequest request;
+  request.advance_time = true;
+  std::vector<f64> tick_ms;
+  tick_ms.reserve(recording.ticks);
+  auto run_until = [&](u64 tick) {
+    while (tick_ms.size() < tick) {
+      auto start = Clock::now();
+      Tick(sim, request);
+      tick_ms.push_back(Millis(Clock::now() - start).count());
+      u64 ticks = tick_ms.size();
+      stats.Append(sim);
+
+      bool checking = check_digests && !recorded_mismatch;
+      if (checking || verify) {
+        hasher.Update(sim);
+      }
+      if (checking && ticks <= recording.digests.size() &&
+          hasher.Last().Whole() != recording.digests[ticks - 1]) {
+        recorded_mismatch = ticks;
+      }
+      if (verify) {
+        digests.push_back(hasher.Last());
+      }
+    }
+  };
+
+  // Commands only steer when ticks happen and what the UI shows, so replaying
+  // them is a matter of ticking to the right point; stale selections are
+  // resolved to show that the recorded handles still line up
+  usize stale_selections = 0;
+  for (const auto& command : recording.commands) {
+    run_until(command.tick);
+    if (command.kind == runner::CommandKind::Select &&
+        command.id_kind != EntityIdKind::INVALID &&
+        !Resolve(runner::ToEntityId(sim, command)).IsValid()) {
+      stale_selections++;
+    }
+  }
+  run_until(recording.ticks);
+
+  // The second run goes after the timed one, so the pool is switched once
+  // rather than twice a tick
+  if (verify) {
+    UsePool(verify_threads);
+    Sim other;
+    StateHasher other_hasher;
+    if (InitFrom(other, recording)) {
+      for (u64 tick = 1; tick <= digests.size(); ++tick) {
+        Tick(other, request);
+        if (other_hasher.Update(other) != digests[tick - 1]) {
+          diverged = tick;
+          break;
+        }
+      }
+    } else {
+      verify = false;
+    }
+    // Only digests were kept, so to name the slot the timed run is made
+    // again up to the tick where they first differ
+    if (diverged) {
+      UsePool(num_threads);
+      Sim again;
+      StateHasher again_hasher;
+      InitFrom(again, recording);
+      for (u64 tick = 1; tick <= diverged; ++tick) {
+        Tick(again, request);
+        again_hasher.Update(again);
+      }
+      FindDivergence(again_hasher, other_hasher, divergence);
+    }
+  }
+  if (stats.IsOpen()) {
+    stats.Close();
+    auto export_stats = stats.Stats();
+    std::printf("stats: %llu ticks in %llu blocks, %.1f MB raw, %.1f MB written, "
+                "%llu stalls\n",
+        (unsigned long long)export_stats.ticks,
+        (unsigned long long)export_stats.blocks,
+        f64(export_stats.raw_bytes) / 1e6, f64(export_stats.written_bytes) / 1e6,
+        (unsigned long long)export_stats.stalls);
+  }
+
+  if (csv_path) {
+    if (FILE* csv = std::fopen(csv_path, "w")) {
+      std::fprintf(csv, "tick,ms\n");
+      for (usize i = 0; i < tick_ms.size(); ++i) {
+        std::fprintf(csv, "%zu,%.4f\n", i + 1, tick_ms[i]);
+      }
+      std::fclose(csv);
+    } else {
+      std::cout << "Could not open '" << csv_path << "'" << std::endl;
+    }
+  }
+
+  std::vector<f64> sorted = tick_ms;
+  std::sort(sorted.begin(), sorted.end());
+  f64 total = 0.0;
+  for (f64 ms : tick_ms) {
+    total += ms;
+  }
+  usize n = tick_ms.size();
+  std::printf("%zu commands, %zu ticks on %zu threads\n",
+      recording.commands.size(), n, num_threads);
+  if (stale_selections > 0) {
+    std::printf("%zu selections no longer resolve\n", stale_selections);
+  }
+  if (check_digests) {
+    if (recorded_mismatch) {
+      std::printf("state differs from the recording after tick %llu\n",
+          (unsigned long long)recorded_mismatch);
+    } else {
+      std::printf("state matches the recording\n");
+    }
+  }
+  if (verify) {
+    if (!diverged) {
+      std::printf("run on %zu threads matches\n", verify_threads);
+    } else if (divergence.part == DigestPart::Globals) {
+      std::printf("run on %zu threads diverges after tick %llu in globals\n",
+          verify_threads, (unsigned long long)diverged);
+    } else {
+      std::printf("run on %zu threads diverges after tick %llu at %s slot %u\n",
+          verify_threads, (unsigned long long)diverged,
+          ToString(divergence.part), divergence.slot);
+    }
+  }
+  std::printf("total %.2f ms, mean %.3f ms\n", total, n ? total / f64(n) : 0.0);
+  std::printf("p50 %.3f ms, p95 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+      Percentile(sorted, 0.50), Percentile(sorted, 0.95),
+      Percentile(sorted, 0.99), n ? sorted.back() : 0.0);
+
+  std::vector<usize> slowest(n);
+  for (usize i = 0; i < n; ++i) {
+    slowest[i] = i;
+  }
+  usize shown = std::min(NUM_SLOWEST, n);
+  std::partial_sort(slowest.begin(), slowest.begin() + shown, slowest.end(),
+      [&](usize a, usize b) { return tick_ms[a] > tick_ms[b]; });
+  for (usize i = 0; i < shown; ++i) {
+    std::printf("  tick %zu: %.3f ms\n", slowest[i] + 1, tick_ms[slowest[i]]);
+  }
+  std::printf("final day %llu, money %lld\n", (unsigned long long)sim.date.epoch,
+      (long long)TotalMoney(sim));
+
+  jobs::Shutdown();
+  return 0;
+}
@@ -0,0 +1,320 @@
+#include <runner.h>
+
+#include <algorithm>
+
+#include <save.h>
+
+namespace runner {
+using namespace simulation;
+
+using Seconds = std::chrono::duration<f64>;
+using Millis = std::chrono::duration<f64, std::milli>;
+
+// Snapshots are published at most this often while ticking, so the sim does
+// not spend its time building views nobody will see
+static const Seconds PUBLISH_INTERVAL{1.0 / 120.0};
+// How often the achieved tick rate is recomputed
+static const Seconds RATE_WINDOW{0.5};
+// Longest sleep while running at a fixed speed, so commands are not left
+// waiting for the next tick
+static const Seconds MAX_SLEEP{0.005};
+// A fixed speed never tries to catch up on more than this many ticks
+static const i64 MAX_CATCH_UP = 4;
+
+void Runner::Start(Options options) {
+  this->options = options;
+  this->autosave_chain = SaveChain(options.autosave_compact_every);
+  simulation::InitEmpty(this->sim);
+  bool loaded =
+      this->options.load_path && LoadSim(this->sim, this->options.load_path);
+  if (!loaded) {
+    simulation::InitScenario(this->sim);
+  }
+  this->history.Init(this->sim);
+  if (this->options.record_path) {
+    this->recorder.Open(this->options.record_path, this->sim,
+        loaded ? this->options.load_path : nullptr);
+  }
+
+  auto now = Clock::now();
+  this->next_tick = now;
+  this->last_publish = now;
+  this->window_start = now;
+
+  // Make sure the UI has something to show before the first tick
+  this->Publish();
+  this->quit = false;
+  if (this->options.threaded) {
+    this->thread = std::thread([this] { this->Main(); });
+  }
+}
+
+void Runner::Stop() {
+  this->quit = true;
+  this->num_pushed.fetch_add(1);
+  this->num_pushed.notify_one();
+  if (this->thread.joinable()) {
+    this->thread.join();
+  }
+  this->autosave.Wait();
+  this->recorder.Close(this->stats.ticks);
+}
+
+bool Runner::Push(Command command) {
+  if (!this->commands.Push(command)) {
+    return false;
+  }
+  this->num_pushed.fetch_add(1);
+  this->num_pushed.notify_one();
+  return true;
+}
+
+void Runner::Publish() {
+  auto& snapshot = this->snapshots.Back();
+  snapshot.arena.Reset();
+
+  snapshot.sequence = ++this->num_published;
+  snapshot.owners_version = this->sim.aggregates.OwnersVersion();
+  snapshot.date = this->sim.date;
+  snapshot.speed = this->speed;
+  snapshot.stats = this->stats;
+  snapshot.map_items = ViewMapItems(this->sim, snapshot.arena);
+
+  snapshot.selected_id = this->selected_id;
+  snapshot.selected = nullptr;
+  // A selected pop that was merged away shows the pop that absorbed it
+  auto selected_id = Resolve(this->selected_id);
+  if (selected_id.IsValid()) {
+    auto ctx = ExtractCtx{
+        .sim = this->sim,
+        .arena = snapshot.arena,
+    };
+    snapshot.selected = Extract(ctx, selected_id);
+  }
+
+  snapshot.population_daily.clear();
+  snapshot.population_monthly.clear();
+  if (selected_id.IsValid() && selected_id.kind == EntityIdKind::Location) {
+    usize slot =
+        this->sim.locations.IndexOf(*(const Location*)selected_id.handle);
+    auto copy = [&](std::vector<f32>& out, Tier tier) {
+      auto values = this->history.Latest(Metric::Population, tier, Stat::Mean,
+          slot, this->history.Count(Metric::Population, tier));
+      out.assign(values.begin(), values.end());
+    };
+    copy(snapshot.population_daily, Tier::Daily);
+    copy(snapshot.population_monthly, Tier::Monthly);
+  }
+
+  this->snapshots.Publish();
+}
+
+void Runner::ProcessCommands() {
+  while (auto command = this->commands.Pop()) {
+    this->recorder.Record(this->sim, this->stats.ticks, *command);
+    switch (command->kind) {
+    case CommandKind::AdvanceDay:
+      this->requested_ticks++;
+      break;
+    case CommandKind::Select:
+      this->selected_id = command->id;
+      this->changed = true;
+      break;
+    case CommandKind::SetSpeed:
+      this->speed = command->speed;
+      this->next_tick = Clock::now();
+      this->due_ticks = 0;
+      if (this->speed == Speed::Paused) {
+        this->stats.ticks_per_second = 0.0;
+      }
+      this->changed = true;
+      break;
+    case CommandKind::Save:
+      this->save_pending = true;
+      break;
+    }
+  }
+  this->SaveIfPending();
+}
+
+// Saves only between ticks; a sliced tick in progress finishes first
+void Runner::SaveIfPending() {
+  if (this->save_pending && !this->sim.systems.InProgress()) {
+    SaveSim(this->sim, this->options.save_path);
+    this->save_pending = false;
+  }
+}
+
+// Counts the ticks a fixed speed setting owes since the last call
+void Runner::ScheduleTicks(Clock::time_point now) {
+  f64 rate = TickRate(this->speed);
+  if (rate <= 0.0) {
+    return;
+  }
+  auto interval =
+      std::chrono::duration_cast<Clock::duration>(Seconds(1.0 / rate));
+  if (now - this->next_tick > interval * MAX_CATCH_UP) {
+    this->next_tick = now;
+  }
+  while (this->next_tick <= now) {
+    this->due_ticks = std::min<u64>(this->due_ticks + 1, MAX_CATCH_UP);
+    this->next_tick += interval;
+  }
+}
+
+void Runner::FinishTick(f64 elapsed_ms) {
+  if (this->due_ticks > 0) {
+    this->due_ticks--;
+  } else if (this->requested_ticks > 0) {
+    this->requested_ticks--;
+  }
+  this->stats.ticks++;
+  this->stats.last_tick_ms = elapsed_ms;
+  this->window_ticks++;
+  this->changed = true;
+  this->history.Sample(this->sim);
+  if (this->options.record_path) {
+    this->recorder.RecordDigest(
+        this->stats.ticks, this->hasher.Update(this->sim).Whole());
+  }
+  this->SaveIfPending();
+
+  // A save still in flight makes this one skip; the next interval catches up
+  this->PollAutosave();
+  u64 interval = this->options.autosave_days;
+  if (interval > 0 && this->sim.date.epoch % interval == 0 &&
+      !this->autosave.InFlight()) {
+    auto plan = this->autosave_chain.Next(this->sim);
+    if (!this->autosave.Start(this->sim, this->options.autosave_path, plan)) {
+      this->autosave_chain.Reset();
+    }
+  }
+}
+
+void Runner::PollAutosave() {
+  switch (this->autosave.Poll()) {
+  case AutosaveStatus::Done:
+    this->stats.autosaves++;
+    this->changed = true;
+    break;
+  case AutosaveStatus::Failed:
+    this->autosave_chain.Reset();
+    this->stats.failed_autosaves++;
+    this->changed = true;
+    break;
+  case AutosaveStatus::Idle:
+  case AutosaveStatus::InFlight:
+    break;
+  }
+}
+
+void Runner::UpdateRate(Clock::time_point now) {
+  if (this->speed == Speed::Paused) {
+    this->window_start = now;
+    this->window_ticks = 0;
+    return;
+  }
+  if (now - this->window_start >= RATE_WINDOW) {
+    this->stats.ticks_per_second =
+        this->window_ticks / Seconds(now - this->window_start).count();
+    this->window_ticks = 0;
+    this->window_start = now;
+    this->changed = true;
+  }
+}
+
+void Runner::MaybePublish(Clock::time_point now) {
+  bool publish_due = now - this->last_publish >= PUBLISH_INTERVAL;
+  if (this->changed && (publish_due || this->speed == Speed::Paused)) {
+    this->Publish();
+    this->last_publish = now;
+    this->changed = false;
+  }
+}
+
+static inline TickRequest AdvanceRequest() {
+  TickRequest request;
+  request.advance_time = true;
+  return request;
+}
+
+void Runner::Main() {
+  while (!this->quit) {
+    u64 seen = this->num_pushed.load();
+
+    this->ProcessCommands();
+    this->PollAutosave();
+    this->ScheduleTicks(Clock::now());
+
+    auto step = [&] {
+      auto start = Clock::now();
+      Tick(this->sim, AdvanceRequest());
+      this->FinishTick(Millis(Clock::now() - start).count());
+    };
+
+    while (this->requested_ticks + this->due_ticks > 0) {
+      step();
+    }
+    if (this->speed == Speed::Max) {
+      // Tick flat out until the next snapshot is due
+      do {
+        step();
+      } while (Clock::now() - this->last_publish < PUBLISH_INTERVAL &&
+               this->num_pushed.load() == seen);
+    }
+
+    auto now = Clock::now();
+    this->UpdateRate(now);
+    this->MaybePublish(now);
+
+    switch (this->speed) {
+    case Speed::Paused:
+      // Nothing to do until the UI says so
+      this->num_pushed.wait(seen);
+      break;
+    case Speed::Max:
+      break;
+    default: {
+      auto max_sleep = std::chrono::duration_cast<Clock::duration>(MAX_SLEEP);
+      std::this_thread::sleep_until(std::min(this->next_tick, now + max_sleep));
+      break;
+    }
+    }
+  }
+}
+
+void Runner::Frame() {
+  if (this->options.threaded) {
+    return;
+  }
+  auto start = Clock::now();
+  auto deadline = start + std::chrono::duration_cast<Clock::duration>(
+                              Millis(this->options.frame_budget_ms));
+
+  this->ProcessCommands();
+  this->PollAutosave();
+  this->ScheduleTicks(start);
+
+  while (this->requested_ticks + this->due_ticks > 0 ||
+         this->speed == Speed::Max || this->sim.systems.InProgress()) {
+    auto slice_start = Clock::now();
+    bool done = TickSlice(this->sim, AdvanceRequest(), deadline);
+    this->slice_ms += Millis(Clock::now() - slice_start).count();
+    if (done) {
+      this->FinishTick(this->slice_ms);
+      this->slice_ms = 0.0;
+    }
+    if (Clock::now() >= deadline) {
+      break;
+    }
+  }
+
+  auto now = Clock::now();
+  this->UpdateRate(now);
+  // Never publish a half-done tick
+  if (!this->sim.systems.InProgress()) {
+    this->MaybePublish(now);
+  }
+}
+
+} // namespace runner
@@ -0,0 +1,1449 @@
+#include <save.h>
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <span>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <jobs.h>
+#include <simulation.h>
+
+// Deflate from the copies vendored with raylib, which also builds them
+extern "C" {
+#include <external/sdefl.h>
+#include <external/sinfl.h>
+}
+
+namespace simulation {
+
+static const char SAVE_MAGIC[8] = {'E', 'C', 'O', 'N', 'S', 'A', 'V', 'E'};
+static const u32 SAVE_VERSION = 4;
+// Records swizzled or fixed up per parallel task
+static const usize SWIZZLE_CHUNK = 16384;
+static const u32 NIL = std::numeric_limits<u32>::max();
+// Anything larger is taken for a corrupt file rather than allocated
+static const u64 MAX_POOL_CAPACITY = 1 << 24;
+// Compressed saves are the plain format deflated in independent chunks
+static const char COMPRESSED_MAGIC[8] = {'E', 'C', 'O', 'N', 'S', 'A', 'V', 'Z'};
+static const usize DEFLATE_CHUNK = 1 << 20;
+static const int DEFLATE_LEVEL = SDEFL_LVL_DEF;
+
+// Pops and buildings are written as raw records
+static_assert(std::is_trivially_copyable_v<Pop>);
+static_assert(std::is_trivially_copyable_v<Building>);
+static_assert(std::is_trivially_copyable_v<TradeFlow>);
+
+enum class BlockTag : u32 {
+  Meta = 1,
+  Strings,
+  Pops,
+  Buildings,
+  Locations,
+  Countries,
+  Edges,
+  Markets,
+  Events,
+  Gdp,
+  // Delta saves: pops and buildings changed since the previous save
+  PopsDelta,
+  BuildingsDelta,
+  Chain,
+  Trade,
+};
+
+struct FileHeader {
+  char magic[8];
+  u32 version{0};
+  u32 reserved{0};
+};
+
+struct BlockHeader {
+  BlockTag tag{BlockTag::Meta};
+  u32 reserved{0};
+  u64 size{0};
+};
+
+struct CompressedHeader {
+  char magic[8];
+  u32 version{0};
+  u32 reserved{0};
+  u64 raw_size{0};
+  u64 num_chunks{0};
+};
+
+struct ChunkHeader {
+  u32 raw_size{0};
+  u32 packed_size{0};
+};
+
+struct MetaRecord {
+  u64 epoch{0};
+  u64 seed{0};
+  Money world{0};
+  u32 player_country{NIL};
+  u32 num_goods{0};
+  u32 num_pop_types{0};
+  u32 num_building_types{0};
+};
+
+// Bases carry sequence 0; deltas count up from 1
+struct ChainRecord {
+  u64 chain_id{0};
+  u64 sequence{0};
+};
+
+struct PoolRecord {
+  u64 capacity{0};
+  u64 frontier{0};
+  u64 num_free{0};
+};
+
+struct LocationRecord {
+  u64 generation{0};
+  u32 tag{NIL};
+  u32 name{NIL};
+  V2 coords;
+  u32 owner{NIL};
+  u32 owned_index{0};
+};
+
+struct CountryRecord {
+  u64 generation{0};
+  u32 tag{NIL};
+  u32 name{NIL};
+  RGB color;
+  u8 padding[5]{};
+  Money money{0};
+};
+
+struct EventRecord {
+  u64 due{0};
+  i64 amount{0};
+  u64 target_generation{0};
+  u64 destination_generation{0};
+  u32 kind{0};
+  u32 target_kind{0};
+  u32 target{NIL};
+  // Location slot, NIL when the event has none
+  u32 destination{NIL};
+};
+
+// Counts of the arrays that follow in the Trade block
+struct TradeRecord {
+  u64 num_regions{0};
+  u64 num_flows{0};
+  u64 num_markets{0};
+  // Whether the flows were solved on the graph and costs as saved. If not,
+  // the next solve starts over or reprices, as it would have.
+  u32 graph_current{0};
+  u32 costs_current{0};
+};
+
+// Swizzled pointers hold 0 for null and slot + 1 otherwise
+template <typename T, typename B>
+static inline T* Swizzle(T* ptr, const B* base) {
+  return ptr ? (T*)(uintptr_t)(ptr - base + 1) : nullptr;
+}
+
+template <typename T> static inline T* Unswizzle(T* ptr, T* base) {
+  uintptr_t idx = (uintptr_t)ptr;
+  return idx ? base + idx - 1 : nullptr;
+}
+
+template <typename T> static inline bool InRange(T* ptr, usize count) {
+  return (uintptr_t)ptr <= count;
+}
+
+template <typename T> static inline u32 SlotOf(const Pool<T>& pool, const T* ptr) {
+  return ptr ? u32(pool.IndexOf(*ptr)) : NIL;
+}
+
+template <typename T> static inline T* AtSlot(Pool<T>& pool, u32 slot) {
+  return slot == NIL ? nullptr : &pool[slot];
+}
+
+class Writer {
+private:
+  FILE* file;
+  u64 at{0};
+  u64 block_start{0};
+  bool ok{true};
+
+public:
+  explicit Writer(FILE* file) : file(file) {}
+
+  bool Ok() const { return this->ok; }
+
+  void Bytes(const void* data, usize size) {
+    if (size > 0 && this->ok) {
+      this->ok = std::fwrite(data, 1, size, this->file) == size;
+      this->at += size;
+    }
+  }
+
+  template <typename T> void Value(const T& value) {
+    this->Bytes(&value, sizeof(T));
+  }
+
+  template <typename T> void Array(std::span<const T> items) {
+    this->Bytes(items.data(), items.size_bytes());
+  }
+
+  // Keeps every array 8-byte aligned in the mapped file
+  void Align() {
+    static const byte zeros[8] = {};
+    this->Bytes(zeros, (8 - this->at % 8) % 8);
+  }
+
+  void Begin(BlockTag tag) {
+    this->Align();
+    this->block_start = this->at;
+    this->Value(BlockHeader{.tag = tag});
+  }
+
+  void End() {
+    this->Align();
+    if (!this->ok) {
+      return;
+    }
+    u64 size = this->at - this->block_start - sizeof(BlockHeader);
+    this->ok = fseeko(this->file, this->block_start + offsetof(BlockHeader, size),
+                   SEEK_SET) == 0 &&
+               std::fwrite(&size, sizeof(size), 1, this->file) == 1 &&
+               fseeko(this->file, this->at, SEEK_SET) == 0;
+  }
+};
+
+class Reader {
+private:
+  const byte* data{nullptr};
+  usize size{0};
+  usize at{0};
+  bool ok{true};
+
+public:
+  Reader(const byte* data, usize size) : data(data), size(size) {}
+
+  bool Ok() const { return this->ok; }
+  bool Done() const { return this->at >= this->size; }
+
+  template <typename T> std::span<const T> Take(usize count) {
+    static_assert(alignof(T) <= 8);
+    usize bytes = count * sizeof(T);
+    if (!this->ok || count > this->size || this->size - this->at < bytes) {
+      this->ok = false;
+      return {};
+    }
+    auto* items = (const T*)(this->data + this->at);
+    this->at += bytes;
+    return {items, count};
+  }
+
+  template <typename T> const T* One() {
+    auto items = this->Take<T>(1);
+    return items.empty() ? nullptr : items.data();
+  }
+
+  void Align() { this->at = std::min(this->size, (this->at + 7) & ~usize(7)); }
+
+  // Null-terminated string, returned without the terminator
+  std::string_view String() {
+    const auto* start = (const char*)this->data + this->at;
+    const auto* end = this->ok
+                          ? (const char*)std::memchr(start, 0, this->size - this->at)
+                          : nullptr;
+    if (!end) {
+      this->ok = false;
+      return {};
+    }
+    this->at += end - start + 1;
+    return {start, usize(end - start)};
+  }
+
+  // Splits off the payload of the next block
+  Reader Block(BlockTag& tag) {
+    this->Align();
+    const auto* header = this->One<BlockHeader>();
+    if (!header || header->size > this->size - this->at) {
+      this->ok = false;
+      return {nullptr, 0};
+    }
+    tag = header->tag;
+    Reader block(this->data + this->at, header->size);
+    this->at += header->size;
+    return block;
+  }
+};
+
+// Tag and name strings, written once each
+class StringTable {
+private:
+  std::unordered_map<const char*, u32> index;
+
+public:
+  std::vector<const char*> strings;
+
+  u32 Intern(const char* string) {
+    if (!string || string == DEFAULT_STRING) {
+      return NIL;
+    }
+    auto [it, inserted] = this->index.try_emplace(string, this->strings.size());
+    if (inserted) {
+      this->strings.push_back(string);
+    }
+    return it->second;
+  }
+};
+
+
+// Slots a save covers: every slot below the frontier for a base, otherwise
+// the ones touched after `since`
+template <typename T>
+static std::vector<u32> SlotsToWrite(const Pool<T>& pool, const u32* since) {
+  std::vector<u32> slots;
+  for (usize idx = 0; idx < pool.Frontier(); ++idx) {
+    if (!since || pool.StampOf(idx) > *since) {
+      slots.push_back(idx);
+    }
+  }
+  return slots;
+}
+
+template <typename T>
+static void WritePool(Writer& writer, const Pool<T>& pool) {
+  auto free_slots = pool.FreeSlots();
+  writer.Value(PoolRecord{
+      .capacity = pool.Capacity(),
+      .frontier = pool.Frontier(),
+      .num_free = free_slots.size(),
+  });
+  writer.Array(std::span<const u32>(free_slots));
+  writer.Align();
+}
+
+static void WriteSlots(Writer& writer, std::span<const u32> slots) {
+  writer.Value(u64(slots.size()));
+  writer.Array(slots);
+  writer.Align();
+}
+
+// Child lists as CSR: offsets per listed parent, then the child slots
+template <typename Parent, typename Child, typename ListOf>
+static void WriteLists(Writer& writer, const Pool<Parent>& parents,
+    std::span<const u32> slots, const Pool<Child>& children, ListOf list_of) {
+  std::vector<u32> offsets(slots.size() + 1, 0);
+  std::vector<u32> items;
+  for (usize i = 0; i < slots.size(); ++i) {
+    const auto& parent = parents[slots[i]];
+    if (IsValid(parent)) {
+      for (const auto* child : *list_of(parent)) {
+        items.push_back(SlotOf(children, child));
+      }
+    }
+    offsets[i + 1] = items.size();
+  }
+  writer.Array(std::span<const u32>(offsets));
+  writer.Array(std::span<const u32>(items));
+  writer.Align();
+}
+
+// Pops and buildings: copied in chunks, pointers swizzled in the copy.
+// Without a slot list, every slot below the frontier is written.
+template <typename T, typename Fix>
+static void WriteRecords(Writer& writer, const Pool<T>& pool,
+    const std::vector<u32>* slots, Fix swizzle) {
+  usize count = slots ? slots->size() : pool.Frontier();
+  std::vector<T> chunk(std::min(count, SWIZZLE_CHUNK));
+  for (usize begin = 0; begin < count; begin += SWIZZLE_CHUNK) {
+    usize n = std::min(SWIZZLE_CHUNK, count - begin);
+    if (slots) {
+      for (usize i = 0; i < n; ++i) {
+        chunk[i] = pool[(*slots)[begin + i]];
+      }
+    } else {
+      std::memcpy(chunk.data(), pool.Data() + begin, n * sizeof(T));
+    }
+    for (usize i = 0; i < n; ++i) {
+      swizzle(chunk[i]);
+    }
+    writer.Array(std::span<const T>(chunk.data(), n));
+  }
+}
+
+static std::string DeltaPath(const char* path, u64 sequence) {
+  return std::string(path) + "." + std::to_string(sequence);
+}
+
+static bool WriteSave(const Sim& sim, FILE* file, const SavePlan& plan) {
+  const ChangeMarks* since = plan.base ? nullptr : &plan.since;
+
+  Writer writer(file);
+  FileHeader header{.version = SAVE_VERSION};
+  std::memcpy(header.magic, SAVE_MAGIC, sizeof(SAVE_MAGIC));
+  writer.Value(header);
+
+  writer.Begin(BlockTag::Meta);
+  writer.Value(MetaRecord{
+      .epoch = sim.date.epoch,
+      .seed = sim.seed,
+      .world = sim.ledger.world,
+      .player_country = SlotOf(sim.countries, sim.player.country),
+      .num_goods = u32(sim.good_types.size()),
+      .num_pop_types = u32(sim.pop_types.size()),
+      .num_building_types = u32(sim.building_types.size()),
+  });
+  writer.End();
+
+  writer.Begin(BlockTag::Chain);
+  writer.Value(ChainRecord{
+      .chain_id = plan.chain_id,
+      .sequence = plan.base ? 0 : plan.sequence,
+  });
+  writer.End();
+
+  // Records first, so the string table is complete when it is written
+  StringTable strings;
+  auto location_slots =
+      SlotsToWrite(sim.locations, since ? &since->locations : nullptr);
+  std::vector<LocationRecord> locations(location_slots.size());
+  for (usize i = 0; i < locations.size(); ++i) {
+    const auto& location = sim.locations[location_slots[i]];
+    locations[i] = {
+        .generation = location.generation,
+        .tag = strings.Intern(location.tag),
+        .name = strings.Intern(location.name),
+        .coords = location.coords,
+        .owner = SlotOf(sim.countries, location.owner_country),
+        .owned_index = location.owned_index,
+    };
+  }
+  auto country_slots =
+      SlotsToWrite(sim.countries, since ? &since->countries : nullptr);
+  std::vector<CountryRecord> countries(country_slots.size());
+  for (usize i = 0; i < countries.size(); ++i) {
+    const auto& country = sim.countries[country_slots[i]];
+    countries[i] = {
+        .generation = country.generation,
+        .tag = strings.Intern(country.tag),
+        .name = strings.Intern(country.name),
+        .color = country.color,
+        .money = country.money,
+    };
+  }
+
+  writer.Begin(BlockTag::Strings);
+  writer.Value(u64(strings.strings.size()));
+  for (const char* string : strings.strings) {
+    writer.Bytes(string, std::strlen(string) + 1);
+  }
+  writer.End();
+
+  const auto* pop_types = sim.pop_types.data();
+  const auto* building_types = sim.building_types.data();
+  const auto* pops = sim.pops.Data();
+  const auto* all_locations = sim.locations.Data();
+
+  auto swizzle_pop = [&](Pop& pop) {
+    pop.type = Swizzle(pop.type, pop_types);
+    pop.location = Swizzle(pop.location, all_locations);
+    pop.location_chain_next = Swizzle(pop.location_chain_next, pops);
+    pop.merged_into = Swizzle(pop.merged_into, pops);
+  };
+  auto swizzle_building = [&](Building& building) {
+    building.type = Swizzle(building.type, building_types);
+    building.location = Swizzle(building.location, all_locations);
+  };
+
+  if (since) {
+    auto pop_slots = SlotsToWrite(sim.pops, &since->pops);
+    writer.Begin(BlockTag::PopsDelta);
+    WritePool(writer, sim.pops);
+    WriteSlots(writer, pop_slots);
+    WriteRecords(writer, sim.pops, &pop_slots, swizzle_pop);
+    writer.End();
+
+    auto building_slots = SlotsToWrite(sim.buildings, &since->buildings);
+    writer.Begin(BlockTag::BuildingsDelta);
+    WritePool(writer, sim.buildings);
+    WriteSlots(writer, building_slots);
+    WriteRecords(writer, sim.buildings, &building_slots, swizzle_building);
+    writer.End();
+  } else {
+    writer.Begin(BlockTag::Pops);
+    WritePool(writer, sim.pops);
+    WriteRecords(writer, sim.pops, nullptr, swizzle_pop);
+    writer.End();
+
+    writer.Begin(BlockTag::Buildings);
+    WritePool(writer, sim.buildings);
+    WriteRecords(writer, sim.buildings, nullptr, swizzle_building);
+    writer.End();
+  }
+
+  writer.Begin(BlockTag::Locations);
+  WritePool(writer, sim.locations);
+  WriteSlots(writer, location_slots);
+  writer.Array(std::span<const LocationRecord>(locations));
+  writer.Align();
+  WriteLists(writer, sim.locations, location_slots, sim.pops,
+      [](const Location& location) { return location.pops_at_location.get(); });
+  WriteLists(writer, sim.locations, location_slots, sim.buildings,
+      [](const Location& location) {
+        return location.buildings_at_location.get();
+      });
+  writer.End();
+
+  writer.Begin(BlockTag::Countries);
+  WritePool(writer, sim.countries);
+  WriteSlots(writer, country_slots);
+  writer.Array(std::span<const CountryRecord>(countries));
+  writer.Align();
+  WriteLists(writer, sim.countries, country_slots, sim.locations,
+      [](const Country& country) { return country.owned_locations.get(); });
+  writer.End();
+
+  const auto& edges = sim.location_graph.Edges();
+  writer.Begin(BlockTag::Edges);
+  writer.Value(u64(edges.size()));
+  writer.Array(std::span<const LocationGraph::Edge>(edges));
+  writer.End();
+
+  const auto& markets = sim.markets;
+  writer.Begin(BlockTag::Markets);
+  writer.Value(u64(markets.num_goods));
+  writer.Value(u64(markets.supply.size()));
+  for (const auto* column : {&markets.supply, &markets.demand, &markets.imports,
+           &markets.exports, &markets.price}) {
+    writer.Array(std::span<const f64>(*column));
+  }
+  writer.End();
+
+  // In scheduling order, which is the order same-day events fire in
+  std::vector<EventRecord> events;
+  sim.events.ForEachPendingInOrder([&](u64 due, const Event& event) {
+    EventRecord record{
+        .due = due,
+        .amount = event.amount,
+        .target_generation = event.target.generation,
+        .destination_generation = event.destination.generation,
+        .kind = u32(event.kind),
+        .target_kind = u32(event.target.kind),
+        .destination =
+            SlotOf(sim.locations, (const Location*)event.destination.handle),
+    };
+    switch (event.target.kind) {
+    case EntityIdKind::Location:
+      record.target = SlotOf(sim.locations, (const Location*)event.target.handle);
+      break;
+    case EntityIdKind::Building:
+      record.target = SlotOf(sim.buildings, (const Building*)event.target.handle);
+      break;
+    case EntityIdKind::Pop:
+      record.target = SlotOf(sim.pops, (const Pop*)event.target.handle);
+      break;
+    case EntityIdKind::INVALID:
+      break;
+    }
+    events.push_back(record);
+  });
+  writer.Begin(BlockTag::Events);
+  writer.Value(sim.events.Now());
+  writer.Value(u64(events.size()));
+  writer.Array(std::span<const EventRecord>(events));
+  writer.End();
+
+  std::vector<Money> gdp(sim.locations.Capacity());
+  for (usize idx = 0; idx < gdp.size(); ++idx) {
+    gdp[idx] = sim.aggregates.AtLocation(idx).gdp;
+  }
+  writer.Begin(BlockTag::Gdp);
+  writer.Value(u64(gdp.size()));
+  writer.Array(std::span<const Money>(gdp));
+  writer.End();
+
+  // Flows of every region back to back, with region offsets into them
+  const auto& trade = sim.trade;
+  const auto& graph = sim.location_graph;
+  assert(trade.region_repairs.size() == trade.region_flows.size());
+  std::vector<u64> region_offsets(1, 0);
+  std::vector<TradeFlow> flows;
+  for (const auto& region : trade.region_flows) {
+    flows.insert(flows.end(), region.begin(), region.end());
+    region_offsets.push_back(flows.size());
+  }
+  std::vector<u64> repairs(
+      trade.region_repairs.begin(), trade.region_repairs.end());
+  writer.Begin(BlockTag::Trade);
+  writer.Value(TradeRecord{
+      .num_regions = trade.region_flows.size(),
+      .num_flows = flows.size(),
+      .num_markets = trade.solved_net.size(),
+      .graph_current = trade.graph_version == graph.Version(),
+      .costs_current = trade.graph_cost_version == graph.CostVersion(),
+  });
+  writer.Array(std::span<const u64>(region_offsets));
+  writer.Array(std::span<const u64>(repairs));
+  writer.Array(std::span<const TradeFlow>(flows));
+  writer.Array(std::span<const f64>(trade.solved_net));
+  writer.End();
+
+  return writer.Ok();
+}
+
+bool SaveSim(const Sim& sim, const char* path) {
+  // Renamed over the target once complete, as in SaveSimCompressed
+  std::string temp_path = std::string(path) + ".tmp";
+  FILE* file = std::fopen(temp_path.c_str(), "wb");
+  if (!file) {
+    std::cout << "Could not open '" << path << "' for saving" << std::endl;
+    return false;
+  }
+  // Large buffer: most of the file is a few big arrays
+  std::setvbuf(file, nullptr, _IOFBF, 1 << 20);
+
+  bool ok = WriteSave(sim, file, {});
+  ok = (std::fclose(file) == 0) && ok;
+  ok = ok && std::rename(temp_path.c_str(), path) == 0;
+  if (!ok) {
+    std::remove(temp_path.c_str());
+    std::cout << "Failed writing save '" << path << "'" << std::endl;
+  }
+  return ok;
+}
+
+bool SaveSimCompressed(const Sim& sim, const char* path, const SavePlan& plan) {
+  // Serialized to memory first: the writer patches block sizes as it goes
+  char* raw = nullptr;
+  usize raw_size = 0;
+  FILE* memory = open_memstream(&raw, &raw_size);
+  if (!memory) {
+    std::cout << "Could not allocate save buffer" << std::endl;
+    return false;
+  }
+  bool ok = WriteSave(sim, memory, plan);
+  ok = (std::fclose(memory) == 0) && ok;
+
+  // Written next to the target and renamed over it, so a failed save never
+  // replaces a good one
+  std::string target = plan.base ? std::string(path) : DeltaPath(path, plan.sequence);
+  std::string temp_path = target + ".tmp";
+  FILE* file = ok ? std::fopen(temp_path.c_str(), "wb") : nullptr;
+  if (file) {
+    usize num_chunks = (raw_size + DEFLATE_CHUNK - 1) / DEFLATE_CHUNK;
+    CompressedHeader header{
+        .version = SAVE_VERSION,
+        .raw_size = raw_size,
+        .num_chunks = num_chunks,
+    };
+    std::memcpy(header.magic, COMPRESSED_MAGIC, sizeof(COMPRESSED_MAGIC));
+    ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+
+    auto state = std::make_unique<sdefl>();
+    std::vector<byte> packed(sdefl_bound(DEFLATE_CHUNK));
+    for (usize chunk = 0; ok && chunk < num_chunks; ++chunk) {
+      usize begin = chunk * DEFLATE_CHUNK;
+      ChunkHeader chunk_header{u32(std::min(DEFLATE_CHUNK, raw_size - begin))};
+      chunk_header.packed_size = sdeflate(state.get(), packed.data(), raw + begin,
+          chunk_header.raw_size, DEFLATE_LEVEL);
+      ok = std::fwrite(&chunk_header, sizeof(chunk_header), 1, file) == 1 &&
+           std::fwrite(packed.data(), 1, chunk_header.packed_size, file) ==
+               chunk_header.packed_size;
+    }
+    ok = (std::fclose(file) == 0) && ok;
+    ok = ok && std::rename(temp_path.c_str(), target.c_str()) == 0;
+    if (!ok) {
+      std::remove(temp_path.c_str());
+    }
+  } else {
+    ok = false;
+  }
+  std::free(raw);
+
+  // The new base is in place, so the old chain can go
+  if (ok && plan.base) {
+    for (u64 sequence = 1; sequence <= plan.stale_deltas; ++sequence) {
+      std::remove(DeltaPath(path, sequence).c_str());
+    }
+  }
+  if (!ok) {
+    std::cout << "Failed writing save '" << target << "'" << std::endl;
+  }
+  return ok;
+}
+
+static u64 NewChainId() {
+  std::random_device device;
+  u64 id = (u64(device()) << 32) | device();
+  return id != 0 ? id : 1;
+}
+
+SavePlan SaveChain::Next(Sim& sim) {
+  ChangeMarks ended{
+      .pops = sim.pops.Checkpoint(),
+      .buildings = sim.buildings.Checkpoint(),
+      .locations = sim.locations.Checkpoint(),
+      .countries = sim.countries.Checkpoint(),
+  };
+  SavePlan plan;
+  if (this->chain_id == 0 || this->num_deltas >= this->compact_every) {
+    plan.stale_deltas = this->num_deltas;
+    this->chain_id = NewChainId();
+    this->num_deltas = 0;
+  } else {
+    plan.base = false;
+    plan.sequence = ++this->num_deltas;
+    plan.since = this->marks;
+  }
+  plan.chain_id = this->chain_id;
+  this->marks = ended;
+  return plan;
+}
+
+void SaveChain::Reset() { this->chain_id = 0; }
+
+struct PoolView {
+  const PoolRecord* pool{nullptr};
+  std::span<const u32> free_slots;
+};
+
+template <typename T> struct RecordsView {
+  PoolView pool;
+  // Slot of each record; unused when `all` is set and the records cover
+  // every slot below the frontier
+  std::span<const u32> slots;
+  std::span<const T> records;
+  bool all{false};
+
+  u32 SlotAt(usize i) const { return this->all ? u32(i) : this->slots[i]; }
+};
+
+struct ListsView {
+  std::span<const u32> offsets;
+  std::span<const u32> items;
+};
+
+// Every block of a mapped save, checked but not yet applied
+struct SaveView {
+  const MetaRecord* meta{nullptr};
+  const ChainRecord* chain{nullptr};
+  std::vector<std::string_view> strings;
+  RecordsView<Pop> pops;
+  RecordsView<Building> buildings;
+  RecordsView<LocationRecord> locations;
+  ListsView location_pops;
+  ListsView location_buildings;
+  RecordsView<CountryRecord> countries;
+  ListsView owned_locations;
+  std::span<const LocationGraph::Edge> edges;
+  u64 num_goods{0};
+  std::span<const f64> market_columns[5];
+  u64 events_now{0};
+  std::span<const EventRecord> events;
+  std::span<const Money> gdp;
+  const TradeRecord* trade{nullptr};
+  std::span<const u64> region_offsets;
+  std::span<const u64> region_repairs;
+  std::span<const TradeFlow> trade_flows;
+  std::span<const f64> solved_net;
+
+  bool IsDelta() const { return this->chain->sequence > 0; }
+};
+
+static PoolView ReadPool(Reader& reader) {
+  PoolView view;
+  view.pool = reader.One<PoolRecord>();
+  if (view.pool) {
+    view.free_slots = reader.Take<u32>(view.pool->num_free);
+  }
+  reader.Align();
+  return view;
+}
+
+static std::span<const u32> ReadSlots(Reader& reader) {
+  std::span<const u32> slots;
+  if (const auto* count = reader.One<u64>()) {
+    slots = reader.Take<u32>(*count);
+  }
+  reader.Align();
+  return slots;
+}
+
+// Pool state, then either every record or a slot list and its records
+template <typename T>
+static void ReadRecords(Reader& reader, RecordsView<T>& view, bool all) {
+  view.pool = ReadPool(reader);
+  if (!view.pool.pool) {
+    return;
+  }
+  view.all = all;
+  if (all) {
+    view.records = reader.Take<T>(view.pool.pool->frontier);
+  } else {
+    view.slots = ReadSlots(reader);
+    view.records = reader.Take<T>(view.slots.size());
+  }
+  reader.Align();
+}
+
+static ListsView ReadLists(Reader& reader, usize num_parents) {
+  ListsView view;
+  view.offsets = reader.Take<u32>(num_parents + 1);
+  if (!view.offsets.empty()) {
+    view.items = reader.Take<u32>(view.offsets.back());
+  }
+  reader.Align();
+  return view;
+}
+
+template <typename T> static bool ValidPool(const RecordsView<T>& view) {
+  const auto* pool = view.pool.pool;
+  if (!pool || pool->capacity > MAX_POOL_CAPACITY ||
+      pool->frontier > pool->capacity) {
+    return false;
+  }
+  std::vector<u8> seen(pool->frontier, 0);
+  for (u32 slot : view.pool.free_slots) {
+    if (slot >= pool->frontier || seen[slot]) {
+      return false;
+    }
+    seen[slot] = 1;
+  }
+  // Slot lists are strictly increasing, so no slot is written twice
+  for (usize i = 0; i < view.slots.size(); ++i) {
+    if (view.slots[i] >= pool->frontier ||
+        (i > 0 && view.slots[i] <= view.slots[i - 1])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool ValidLists(const ListsView& view, usize num_children) {
+  for (usize i = 1; i < view.offsets.size(); ++i) {
+    if (view.offsets[i] < view.offsets[i - 1]) {
+      return false;
+    }
+  }
+  for (u32 item : view.items) {
+    if (item >= num_children) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Runs check(record) over a block of records in parallel
+template <typename T, typename Check>
+static bool ValidRecords(std::span<const T> records, Check check) {
+  // u8 rather than bool: partial results are written from several threads
+  return jobs::Reduce(
+      usize(0), records.size(), SWIZZLE_CHUNK, u8(1),
+      [&](usize begin, usize end) {
+        for (usize i = begin; i < end; ++i) {
+          if (!check(records[i])) {
+            return u8(0);
+          }
+        }
+        return u8(1);
+      },
+      [](u8 a, u8 b) { return u8(a & b); });
+}
+
+static bool ParseSave(const Sim& sim, std::span<const byte> bytes, SaveView& view) {
+  Reader file(bytes.data(), bytes.size());
+  const auto* header = file.One<FileHeader>();
+  if (!header || std::memcmp(header->magic, SAVE_MAGIC, sizeof(SAVE_MAGIC)) != 0 ||
+      header->version != SAVE_VERSION) {
+    return false;
+  }
+
+  while (file.Ok() && !file.Done()) {
+    BlockTag tag{BlockTag::Meta};
+    Reader reader = file.Block(tag);
+    if (!file.Ok()) {
+      break;
+    }
+    switch (tag) {
+    case BlockTag::Meta:
+      view.meta = reader.One<MetaRecord>();
+      break;
+    case BlockTag::Chain:
+      view.chain = reader.One<ChainRecord>();
+      break;
+    case BlockTag::Strings: {
+      const auto* count = reader.One<u64>();
+      for (u64 i = 0; count && i < *count && reader.Ok(); ++i) {
+        view.strings.push_back(reader.String());
+      }
+      break;
+    }
+    case BlockTag::Pops:
+    case BlockTag::PopsDelta:
+      ReadRecords(reader, view.pops, tag == BlockTag::Pops);
+      break;
+    case BlockTag::Buildings:
+    case BlockTag::BuildingsDelta:
+      ReadRecords(reader, view.buildings, tag == BlockTag::Buildings);
+      break;
+    case BlockTag::Locations:
+      ReadRecords(reader, view.locations, false);
+      view.location_pops = ReadLists(reader, view.locations.records.size());
+      view.location_buildings = ReadLists(reader, view.locations.records.size());
+      break;
+    case BlockTag::Countries:
+      ReadRecords(reader, view.countries, false);
+      view.owned_locations = ReadLists(reader, view.countries.records.size());
+      break;
+    case BlockTag::Edges: {
+      const auto* count = reader.One<u64>();
+      if (count) {
+        view.edges = reader.Take<LocationGraph::Edge>(*count);
+      }
+      break;
+    }
+    case BlockTag::Markets: {
+      const auto* num_goods = reader.One<u64>();
+      const auto* count = reader.One<u64>();
+      if (num_goods && count) {
+        view.num_goods = *num_goods;
+        for (auto& column : view.market_columns) {
+          column = reader.Take<f64>(*count);
+        }
+      }
+      break;
+    }
+    case BlockTag::Events: {
+      const auto* now = reader.One<u64>();
+      const auto* count = reader.One<u64>();
+      if (now && count) {
+        view.events_now = *now;
+        view.events = reader.Take<EventRecord>(*count);
+      }
+      break;
+    }
+    case BlockTag::Gdp: {
+      const auto* count = reader.One<u64>();
+      if (count) {
+        view.gdp = reader.Take<Money>(*count);
+      }
+      break;
+    }
+    case BlockTag::Trade: {
+      view.trade = reader.One<TradeRecord>();
+      if (view.trade) {
+        view.region_offsets = reader.Take<u64>(view.trade->num_regions + 1);
+        view.region_repairs = reader.Take<u64>(view.trade->num_regions);
+        view.trade_flows = reader.Take<TradeFlow>(view.trade->num_flows);
+        view.solved_net = reader.Take<f64>(view.trade->num_markets);
+      }
+      break;
+    }
+    default:
+      // Unknown blocks are skipped
+      break;
+    }
+    if (!reader.Ok()) {
+      return false;
+    }
+  }
+  if (!file.Ok() || !view.meta || !view.chain) {
+    return false;
+  }
+
+  // Definitions must match the ones this build creates
+  const auto& meta = *view.meta;
+  if (meta.num_goods != sim.good_types.size() ||
+      meta.num_pop_types != sim.pop_types.size() ||
+      meta.num_building_types != sim.building_types.size()) {
+    return false;
+  }
+
+  if (!ValidPool(view.pops) || !ValidPool(view.buildings) ||
+      !ValidPool(view.locations) || !ValidPool(view.countries)) {
+    return false;
+  }
+  // A base holds whole pools. A delta patches the live ones, which must
+  // have the same capacities.
+  bool delta = view.IsDelta();
+  if (view.pops.all == delta || view.buildings.all == delta) {
+    return false;
+  }
+  if (delta && (view.pops.pool.pool->capacity != sim.pops.Capacity() ||
+                   view.buildings.pool.pool->capacity != sim.buildings.Capacity() ||
+                   view.locations.pool.pool->capacity != sim.locations.Capacity() ||
+                   view.countries.pool.pool->capacity != sim.countries.Capacity())) {
+    return false;
+  }
+  usize num_pops = view.pops.pool.pool->frontier;
+  usize num_buildings = view.buildings.pool.pool->frontier;
+  usize num_locations = view.locations.pool.pool->frontier;
+  usize num_countries = view.countries.pool.pool->frontier;
+  usize num_strings = view.strings.size();
+
+  if (meta.player_country != NIL && meta.player_country >= num_countries) {
+    return false;
+  }
+  if (!ValidLists(view.location_pops, num_pops) ||
+      !ValidLists(view.location_buildings, num_buildings) ||
+      !ValidLists(view.owned_locations, num_locations)) {
+    return false;
+  }
+
+  // Ownership back-indices must agree with the country lists, for every
+  // location the file holds
+  std::vector<u32> location_record(num_locations, NIL);
+  for (usize i = 0; i < view.locations.records.size(); ++i) {
+    location_record[view.locations.SlotAt(i)] = i;
+  }
+  const auto& owned = view.owned_locations;
+  for (usize i = 0; i + 1 < owned.offsets.size(); ++i) {
+    u32 country = view.countries.SlotAt(i);
+    for (u32 j = owned.offsets[i]; j < owned.offsets[i + 1]; ++j) {
+      u32 record = location_record[owned.items[j]];
+      if (record == NIL) {
+        continue;
+      }
+      const auto& location = view.locations.records[record];
+      if (location.owner != country || location.owned_index != j - owned.offsets[i]) {
+        return false;
+      }
+    }
+  }
+
+  auto valid_string = [&](u32 idx) { return idx == NIL || idx < num_strings; };
+  auto valid_slot = [](u32 slot, usize count) {
+    return slot == NIL || slot < count;
+  };
+  bool records_ok =
+      ValidRecords(view.pops.records,
+          [&](const Pop& pop) {
+            return InRange(pop.type, sim.pop_types.size()) &&
+                   InRange(pop.location, num_locations) &&
+                   (!IsValid(pop) || (pop.type && pop.location)) &&
+                   InRange(pop.location_chain_next, num_pops) &&
+                   InRange(pop.merged_into, num_pops);
+          }) &&
+      ValidRecords(view.buildings.records,
+          [&](const Building& building) {
+            return InRange(building.type, sim.building_types.size()) &&
+                   InRange(building.location, num_locations) &&
+                   (!IsValid(building) || (building.type && building.location));
+          }) &&
+      ValidRecords(view.locations.records,
+          [&](const LocationRecord& record) {
+            return valid_string(record.tag) && valid_string(record.name) &&
+                   valid_slot(record.owner, num_countries);
+          }) &&
+      ValidRecords(view.countries.records, [&](const CountryRecord& record) {
+        return valid_string(record.tag) && valid_string(record.name);
+      });
+  if (!records_ok) {
+    return false;
+  }
+
+  for (const auto& edge : view.edges) {
+    if (edge.a >= num_locations || edge.b >= num_locations) {
+      return false;
+    }
+  }
+  for (const auto& event : view.events) {
+    usize targets = 0;
+    switch (EntityIdKind(event.target_kind)) {
+    case EntityIdKind::Location:
+      targets = num_locations;
+      break;
+    case EntityIdKind::Building:
+      targets = num_buildings;
+      break;
+    case EntityIdKind::Pop:
+      targets = num_pops;
+      break;
+    case EntityIdKind::INVALID:
+      break;
+    }
+    if (!valid_slot(event.target, targets) ||
+        !valid_slot(event.destination, num_locations)) {
+      return false;
+    }
+  }
+  if (view.trade) {
+    const auto& offsets = view.region_offsets;
+    for (usize i = 0; i + 1 < offsets.size(); ++i) {
+      if (offsets[i] > offsets[i + 1]) {
+        return false;
+      }
+    }
+    if (offsets.front() != 0 || offsets.back() != view.trade_flows.size()) {
+      return false;
+    }
+    for (const auto& flow : view.trade_flows) {
+      if (flow.from >= num_locations || flow.to >= num_locations) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+template <typename T>
+static void RecreatePool(Pool<T>& pool, const PoolView& view, const char* name) {
+  if (view.pool->capacity > pool.Capacity()) {
+    pool = Pool<T>(name, view.pool->capacity);
+  }
+}
+
+// Pops and buildings: one copy for a whole pool, a scatter for a delta,
+// then pointers fixed in place
+template <typename T, typename Fix>
+static void RestoreRecords(Pool<T>& pool, const RecordsView<T>& view, Fix fix) {
+  T* entries = pool.Data();
+  if (view.all) {
+    std::memcpy(entries, view.records.data(), view.records.size_bytes());
+  }
+  jobs::ParallelFor(0, view.records.size(), SWIZZLE_CHUNK,
+      [&](usize begin, usize end) {
+        for (usize i = begin; i < end; ++i) {
+          T& entry = entries[view.SlotAt(i)];
+          if (!view.all) {
+            entry = view.records[i];
+          }
+          fix(entry);
+        }
+      });
+  pool.Restore(view.pool.pool->frontier, view.pool.free_slots);
+}
+
+template <typename Parent, typename Child, typename ListOf, typename Record>
+static void RestoreLists(Pool<Parent>& parents, const RecordsView<Record>& records,
+    Pool<Child>& children, const ListsView& view, ListOf list_of) {
+  for (usize i = 0; i + 1 < view.offsets.size(); ++i) {
+    auto& parent = parents[records.SlotAt(i)];
+    if (!IsValid(parent)) {
+      continue;
+    }
+    auto& list = *list_of(parent);
+    list.clear();
+    list.reserve(view.offsets[i + 1] - view.offsets[i]);
+    for (u32 j = view.offsets[i]; j < view.offsets[i + 1]; ++j) {
+      list.push_back(&children[view.items[j]]);
+    }
+  }
+}
+
+static void ApplySave(Sim& sim, const SaveView& view) {
+  const auto& meta = *view.meta;
+
+  if (!view.IsDelta()) {
+    RecreatePool(sim.pops, view.pops.pool, "Pops");
+    RecreatePool(sim.buildings, view.buildings.pool, "Buildings");
+    RecreatePool(sim.locations, view.locations.pool, "Locations");
+    RecreatePool(sim.countries, view.countries.pool, "Countries");
+  }
+
+  std::vector<const char*> strings;
+  strings.reserve(view.strings.size());
+  for (auto string : view.strings) {
+    sim.strings.push_back(std::string(string));
+    strings.push_back(sim.strings.back().c_str());
+  }
+  auto string_at = [&](u32 idx) {
+    return idx == NIL ? DEFAULT_STRING : strings[idx];
+  };
+
+  const auto* pop_types = sim.pop_types.data();
+  const auto* building_types = sim.building_types.data();
+  auto* pops = sim.pops.Data();
+  auto* locations = sim.locations.Data();
+  RestoreRecords(sim.pops, view.pops, [&](Pop& pop) {
+    pop.type = Unswizzle(pop.type, pop_types);
+    pop.location = Unswizzle(pop.location, locations);
+    pop.location_chain_next = Unswizzle(pop.location_chain_next, pops);
+    pop.merged_into = Unswizzle(pop.merged_into, pops);
+  });
+  RestoreRecords(sim.buildings, view.buildings, [&](Building& building) {
+    building.type = Unswizzle(building.type, building_types);
+    building.location = Unswizzle(building.location, locations);
+  });
+
+  for (usize i = 0; i < view.countries.records.size(); ++i) {
+    const auto& record = view.countries.records[i];
+    auto& country = sim.countries[view.countries.SlotAt(i)];
+    country.generation = record.generation;
+    country.tag = string_at(record.tag);
+    country.name = string_at(record.name);
+    country.color = record.color;
+    country.money = record.money;
+    if (IsValid(country) && !country.owned_locations) {
+      country.owned_locations = std::make_unique<std::vector<Location*>>();
+    }
+  }
+  sim.countries.Restore(
+      view.countries.pool.pool->frontier, view.countries.pool.free_slots);
+
+  for (usize i = 0; i < view.locations.records.size(); ++i) {
+    const auto& record = view.locations.records[i];
+    auto& location = sim.locations[view.locations.SlotAt(i)];
+    location.generation = record.generation;
+    location.tag = string_at(record.tag);
+    location.name = string_at(record.name);
+    location.coords = record.coords;
+    location.owner_country = AtSlot(sim.countries, record.owner);
+    location.owned_index = record.owned_index;
+    if (IsValid(location) && !location.pops_at_location) {
+      location.pops_at_location = std::make_unique<std::vector<Pop*>>();
+      location.buildings_at_location = std::make_unique<std::vector<Building*>>();
+    }
+  }
+  sim.locations.Restore(
+      view.locations.pool.pool->frontier, view.locations.pool.free_slots);
+
+  RestoreLists(sim.locations, view.locations, sim.pops, view.location_pops,
+      [](Location& location) { return location.pops_at_location.get(); });
+  RestoreLists(sim.locations, view.locations, sim.buildings,
+      view.location_buildings,
+      [](Location& location) { return location.buildings_at_location.get(); });
+  RestoreLists(sim.countries, view.countries, sim.locations, view.owned_locations,
+      [](Country& country) { return country.owned_locations.get(); });
+
+  // Aggregates are rebuilt from the entities, all but the daily GDP
+  usize num_locations = sim.locations.Capacity();
+  sim.aggregates.Init(num_locations, sim.countries.Capacity(), jobs::NumThreads());
+  std::vector<Totals> totals(num_locations);
+  for (const auto& pop : sim.pops) {
+    if (IsValid(pop)) {
+      totals[sim.locations.IndexOf(*pop.location)] += TotalsOf(pop);
+    }
+  }
+  for (const auto& building : sim.buildings) {
+    if (IsValid(building)) {
+      totals[sim.locations.IndexOf(*building.location)] += TotalsOf(building);
+    }
+  }
+  for (usize idx = 0; idx < view.gdp.size() && idx < num_locations; ++idx) {
+    totals[idx].gdp = view.gdp[idx];
+  }
+  for (usize idx = 0; idx < num_locations; ++idx) {
+    const auto& location = sim.locations[idx];
+    if (!IsValid(location)) {
+      continue;
+    }
+    if (location.owner_country) {
+      sim.aggregates.SetOwner(idx, sim.countries.IndexOf(*location.owner_country));
+    }
+    sim.aggregates.Add(idx, totals[idx]);
+  }
+
+  // Built now rather than on the next tick, so the restored trade flows
+  // can be matched to this graph version
+  auto& graph = sim.location_graph;
+  graph.Clear();
+  for (const auto& edge : view.edges) {
+    graph.Connect(edge.a, edge.b, edge.cost);
+  }
+  graph.Build(num_locations);
+
+  auto& markets = sim.markets;
+  markets.Init(num_locations, sim.good_types.size());
+  std::vector<f64>* columns[] = {&markets.supply, &markets.demand,
+      &markets.imports, &markets.exports, &markets.price};
+  for (usize column = 0; column < 5; ++column) {
+    auto* target = columns[column];
+    const auto& source = view.market_columns[column];
+    std::copy_n(source.begin(), std::min(source.size(), target->size()),
+        target->begin());
+  }
+
+  // Without a current solution saved, the next solve starts over
+  auto& trade = sim.trade;
+  trade.region_flows.clear();
+  trade.region_repairs.clear();
+  trade.solved_net.clear();
+  trade.graph_version = graph.Version() + 1;
+  trade.graph_cost_version = graph.CostVersion();
+  if (view.trade && view.trade->graph_current &&
+      view.solved_net.size() == markets.supply.size()) {
+    usize num_regions = view.trade->num_regions;
+    trade.graph_version = graph.Version();
+    if (!view.trade->costs_current) {
+      trade.graph_cost_version = graph.CostVersion() + 1;
+    }
+    trade.region_flows.resize(num_regions);
+    for (usize region = 0; region < num_regions; ++region) {
+      trade.region_flows[region].assign(
+          view.trade_flows.begin() + view.region_offsets[region],
+          view.trade_flows.begin() + view.region_offsets[region + 1]);
+    }
+    trade.region_repairs.assign(
+        view.region_repairs.begin(), view.region_repairs.end());
+    trade.solved_net.assign(view.solved_net.begin(), view.solved_net.end());
+  }
+
+  // Scheduled in the order they were saved in, so same-day events keep
+  // their firing order
+  sim.events.Reset(view.events_now);
+  for (const auto& record : view.events) {
+    Event event{
+        .kind = EventKind(record.kind),
+        .amount = record.amount,
+    };
+    if (record.destination != NIL) {
+      event.destination = EntityId{
+          .kind = EntityIdKind::Location,
+          .handle = AtSlot(sim.locations, record.destination),
+          .generation = record.destination_generation,
+      };
+    }
+    event.target.kind = EntityIdKind(record.target_kind);
+    event.target.generation = record.target_generation;
+    switch (event.target.kind) {
+    case EntityIdKind::Location:
+      event.target.handle = AtSlot(sim.locations, record.target);
+      break;
+    case EntityIdKind::Building:
+      event.target.handle = AtSlot(sim.buildings, record.target);
+      break;
+    case EntityIdKind::Pop:
+      event.target.handle = AtSlot(sim.pops, record.target);
+      break;
+    case EntityIdKind::INVALID:
+      break;
+    }
+    sim.events.Schedule(record.due, event);
+  }
+
+  sim.date.epoch = meta.epoch;
+  sim.seed = meta.seed;
+  sim.ledger.world = meta.world;
+  sim.player.country = AtSlot(sim.countries, meta.player_country);
+}
+
+// A save file's contents: mapped as is, or inflated when compressed
+class SaveFile {
+private:
+  void* map{MAP_FAILED};
+  usize map_size{0};
+  std::vector<byte> inflated;
+
+  // Inflates a compressed save back into the plain format
+  bool Inflate(const byte* data, usize size) {
+    Reader reader(data, size);
+    const auto* header = reader.One<CompressedHeader>();
+    if (!header || header->version != SAVE_VERSION ||
+        header->num_chunks !=
+            (header->raw_size + DEFLATE_CHUNK - 1) / DEFLATE_CHUNK ||
+        header->num_chunks > size / sizeof(ChunkHeader)) {
+      return false;
+    }
+    this->inflated.resize(header->raw_size);
+    usize at = 0;
+    for (usize chunk = 0; chunk < header->num_chunks; ++chunk) {
+      const auto* chunk_header = reader.One<ChunkHeader>();
+      if (!chunk_header || chunk_header->raw_size > this->inflated.size() - at) {
+        return false;
+      }
+      auto packed = reader.Take<byte>(chunk_header->packed_size);
+      if (!reader.Ok() ||
+          sinflate(this->inflated.data() + at, chunk_header->raw_size,
+              packed.data(), packed.size()) != i32(chunk_header->raw_size)) {
+        return false;
+      }
+      at += chunk_header->raw_size;
+    }
+    return at == this->inflated.size();
+  }
+
+public:
+  std::span<const byte> bytes;
+
+  SaveFile() = default;
+  SaveFile(const SaveFile& other) = delete;
+
+  ~SaveFile() {
+    if (this->map != MAP_FAILED) {
+      munmap(this->map, this->map_size);
+    }
+  }
+
+  bool Open(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+      std::cout << "Could not open save '" << path << "'" << std::endl;
+      return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+      close(fd);
+      std::cout << "Could not read save '" << path << "'" << std::endl;
+      return false;
+    }
+    this->map_size = info.st_size;
+    this->map = mmap(nullptr, this->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (this->map == MAP_FAILED) {
+      std::cout << "Could not map save '" << path << "'" << std::endl;
+      return false;
+    }
+
+    const auto* data = (const byte*)this->map;
+    if (this->map_size >= sizeof(COMPRESSED_MAGIC) &&
+        std::memcmp(data, COMPRESSED_MAGIC, sizeof(COMPRESSED_MAGIC)) == 0) {
+      if (!this->Inflate(data, this->map_size)) {
+        return false;
+      }
+      this->bytes = this->inflated;
+    } else {
+      this->bytes = {data, this->map_size};
+    }
+    return true;
+  }
+};
+
+bool LoadSim(Sim& sim, const char* path) {
+  u64 chain_id = 0;
+  {
+    SaveFile file;
+    SaveView view;
+    if (!file.Open(path) || !ParseSave(sim, file.bytes, view) || view.IsDelta()) {
+      std::cout << "Save '" << path << "' is invalid or from another version"
+                << std::endl;
+      return false;
+    }
+    ApplySave(sim, view);
+    chain_id = view.chain->chain_id;
+  }
+
+  // Replay the deltas that continue this base, in order
+  for (u64 sequence = 1; chain_id != 0; ++sequence) {
+    auto delta_path = DeltaPath(path, sequence);
+    if (access(delta_path.c_str(), F_OK) != 0) {
+      break;
+    }
+    SaveFile file;
+    SaveView delta;
+    if (!file.Open(delta_path.c_str()) || !ParseSave(sim, file.bytes, delta) ||
+        !delta.IsDelta() || delta.chain->chain_id != chain_id ||
+        delta.chain->sequence != sequence) {
+      std::cout << "Save '" << delta_path << "' does not continue '" << path
+                << "', loaded up to the one before" << std::endl;
+      break;
+    }
+    ApplySave(sim, delta);
+  }
+  return true;
+}
+
+} // namespace simulation
@@ -0,0 +1,150 @@
+#include <scheduler.h>
+
+#include <algorithm>
+#include <cassert>
+
+#include <jobs.h>
+#include <simulation.h>
+
+namespace simulation {
+
+void Scheduler::Register(System system) {
+  assert(system.run);
+  assert(system.chunk_size > 0);
+  assert(system.period > 0);
+  this->systems.push_back(system);
+}
+
+// Items a system processes on day `epoch`. Counted systems split their items
+// in `period` contiguous buckets and process one bucket per day; single-call
+// systems run on every `period`th day. Empty when there is nothing to do.
+static inline Range ActiveRange(const System& system, const Sim& sim, u64 epoch) {
+  u64 bucket = epoch % system.period;
+  if (!system.count) {
+    return bucket == 0 ? Range{0, 1} : Range{};
+  }
+  usize count = system.count(sim);
+  return Range{
+      .begin = usize(count * bucket / system.period),
+      .end = usize(count * (bucket + 1) / system.period),
+  };
+}
+
+// A system's wave is one past the latest wave of any earlier system it
+// conflicts with. Every edge of the dependency DAG goes from a lower wave to
+// a higher one, so running waves in order respects all of them. Systems with
+// nothing to do this tick are left out of the DAG.
+void Scheduler::BuildWaves(const Sim& sim) {
+  this->waves.clear();
+  this->wave_of.assign(this->systems.size(), 0);
+  this->ranges.assign(this->systems.size(), {});
+
+  for (usize i = 0; i < this->systems.size(); ++i) {
+    const auto& system = this->systems[i];
+    auto range = ActiveRange(system, sim, sim.date.epoch);
+    this->ranges[i] = range;
+    if (range.begin >= range.end) {
+      continue;
+    }
+
+    usize wave = 0;
+    for (usize j = 0; j < i; ++j) {
+      const auto& other = this->ranges[j];
+      if (other.begin < other.end && Conflicts(system, this->systems[j])) {
+        wave = std::max(wave, this->wave_of[j] + 1);
+      }
+    }
+    this->wave_of[i] = wave;
+    if (wave >= this->waves.size()) {
+      this->waves.resize(wave + 1);
+    }
+    this->waves[wave].push_back(i);
+  }
+}
+
+void Scheduler::Run(Sim& sim, const TickRequest& request) {
+  assert(!this->cursor.active);
+  this->BuildWaves(sim);
+
+  struct Chunk {
+    usize system{0};
+    Range range;
+  };
+  std::vector<Chunk> chunks;
+
+  for (const auto& wave : this->waves) {
+    // All chunks of all systems in a wave are independent
+    chunks.clear();
+    for (usize idx : wave) {
+      const auto& system = this->systems[idx];
+      auto range = this->ranges[idx];
+      for (usize begin = range.begin; begin < range.end;
+           begin += system.chunk_size) {
+        usize end = std::min(range.end, begin + system.chunk_size);
+        chunks.push_back({idx, {begin, end}});
+      }
+    }
+    jobs::Run(chunks.size(), [&](usize i) {
+      const auto& chunk = chunks[i];
+      this->systems[chunk.system].run(sim, request, chunk.range);
+    });
+  }
+}
+
+void Scheduler::Begin(const Sim& sim) {
+  assert(!this->cursor.active);
+  this->BuildWaves(sim);
+  this->cursor = Cursor{.active = true};
+  if (!this->waves.empty()) {
+    this->cursor.item = this->ranges[this->waves[0][0]].begin;
+  }
+}
+
+bool Scheduler::Step(
+    Sim& sim, const TickRequest& request, Clock::time_point deadline) {
+  assert(this->cursor.active);
+  auto& cursor = this->cursor;
+
+  // Moves the cursor past exhausted systems and waves
+  auto settle = [&] {
+    while (cursor.wave < this->waves.size()) {
+      const auto& wave = this->waves[cursor.wave];
+      if (cursor.slot >= wave.size()) {
+        cursor.wave++;
+        cursor.slot = 0;
+        if (cursor.wave < this->waves.size()) {
+          cursor.item = this->ranges[this->waves[cursor.wave][0]].begin;
+        }
+      } else if (cursor.item >= this->ranges[wave[cursor.slot]].end) {
+        cursor.slot++;
+        if (cursor.slot < wave.size()) {
+          cursor.item = this->ranges[wave[cursor.slot]].begin;
+        }
+      } else {
+        break;
+      }
+    }
+  };
+
+  settle();
+  while (cursor.wave < this->waves.size()) {
+    usize idx = this->waves[cursor.wave][cursor.slot];
+    const auto& system = this->systems[idx];
+    usize end = std::min(this->ranges[idx].end, cursor.item + system.chunk_size);
+    system.run(sim, request, {cursor.item, end});
+    cursor.item = end;
+    settle();
+
+    if (Clock::now() >= deadline) {
+      break;
+    }
+  }
+
+  bool done = cursor.wave >= this->waves.size();
+  if (done) {
+    cursor = {};
+  }
+  return done;
+}
+
+} // namespace simulation
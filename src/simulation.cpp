@@ -1,4 +1,5 @@
 #include <array>
+#include <cmath>
 #include <initializer_list>
 #include <iostream>
 #include <memory>
@@ -7,8 +8,12 @@
 #include <utility>
 #include <vector>
 
+#include <cohorts.h>
+#include <jobs.h>
 #include <pool.h>
+#include <rng.h>
 #include <simulation.h>
+#include <spawn.h>
 
 namespace simulation {
 using namespace arena;
@@ -64,31 +69,11 @@ template <typename T> unique_vector<T> MakeUniqueVec() {
   return std::make_unique<std::vector<T>>();
 }
 
-static bool IsValid(const Pop& pop) { return pop.generation % 2 == 1; }
-static bool IsValid(const Building& building) {
-  return building.generation % 2 == 1;
-}
-static bool IsValid(const Location& location) {
-  return location.generation % 2 == 1;
-}
-static bool IsValid(const Country& country) {
-  return country.generation % 2 == 1;
-}
-
 const char* StringAlloc(Strings& container, std::string&& data) {
   container.push_back(std::move(data));
   return container.back().c_str();
 }
 
-static inline const PopType* LookupPopType(
-    PopTypes& types, std::string_view tag) {
-  auto lookup = Lookup(types, tag);
-  if (!lookup.found) {
-    std::cout << "Invalid tag for pop_type '" << tag << "'" << std::endl;
-  }
-  return &types[lookup.idx];
-}
-
 static inline Location* LookupLocation(
     Locations& locations, std::string_view tag) {
   auto lookup = Lookup(locations, tag);
@@ -98,27 +83,6 @@ static inline Location* LookupLocation(
   return lookup.ptr;
 }
 
-static inline Pop* PopInit(Sim& sim, std::string_view type_tag,
-    std::string_view location_tag, i64 size) {
-  auto* pop_type = LookupPopType(sim.pop_types, type_tag);
-  auto* location = LookupLocation(sim.locations, location_tag);
-
-  if (!location) {
-    return nullptr;
-  }
-
-  auto& pop = sim.pops.Allocate();
-  pop.generation += 1;
-  pop.type = pop_type;
-  pop.size = size;
-
-  // Add the pop to the list of pops at location
-  pop.location = location;
-  location->pops_at_location->push_back(&pop);
-
-  return &pop;
-}
-
 static inline const BuildingType* LookupBuildingType(
     BuildingTypes& types, std::string_view tag) {
   auto lookup = Lookup(types, tag);
@@ -147,6 +111,8 @@ static inline Building* BuildingInit(Sim& sim, std::string_view type_tag, std::s
   // Add the building to the list of buildings at location
   building.location = location;
   location->buildings_at_location->push_back(&building);
+  sim.locations.Touch(*location);
+  sim.aggregates.Add(sim.locations.IndexOf(*location), TotalsOf(building));
 
   return &building;
 }
@@ -228,6 +194,8 @@ static inline void InitPopTypes(Sim& sim) {
     // Peasants
     auto type = make_type("peasants", "Peasants");
     SetVectorValues(type.demand, sim.good_types, {{"wheat", 1.0}});
+    type.growth = 0.01;
+    type.growth_spread = 0.5;
     sim.pop_types.push_back(type);
   }
 
@@ -235,6 +203,8 @@ static inline void InitPopTypes(Sim& sim) {
     // Burghers
     auto type = make_type("burghers", "Burghers");
     SetVectorValues(type.demand, sim.good_types, {{"wheat", 2.0}});
+    type.growth = 0.005;
+    type.growth_spread = 0.2;
     sim.pop_types.push_back(type);
   }
 
@@ -268,14 +238,257 @@ template <typename T> static inline T& assume_valid(T* ptr) {
   return *ptr;
 }
 
-static void ChangeLocationOwner(
-    Sim& sim, Country* country, Location* location) {
-  assert(!location->owner_country);
-  country->owned_locations->push_back(location);
+static void ConnectLocations(
+    Sim& sim, std::string_view a_tag, std::string_view b_tag, f64 cost) {
+  auto* a = LookupLocation(sim.locations, a_tag);
+  auto* b = LookupLocation(sim.locations, b_tag);
+  if (!a || !b) {
+    return;
+  }
+  sim.location_graph.Connect(
+      sim.locations.IndexOf(*a), sim.locations.IndexOf(*b), cost);
+}
+
+void ChangeLocationOwner(Sim& sim, Country* country, Location* location) {
+  auto* old_country = location->owner_country;
+  if (old_country == country) {
+    return;
+  }
+
+  // Swap-remove from the old owner, fixing the back-index of the moved entry
+  if (old_country) {
+    auto& owned = *old_country->owned_locations;
+    assert(owned[location->owned_index] == location);
+    owned[location->owned_index] = owned.back();
+    owned[location->owned_index]->owned_index = location->owned_index;
+    sim.locations.Touch(*owned[location->owned_index]);
+    owned.pop_back();
+    sim.countries.Touch(*old_country);
+  }
+
   location->owner_country = country;
+  sim.locations.Touch(*location);
+  u32 country_slot = Aggregates::NIL;
+  if (country) {
+    sim.countries.Touch(*country);
+    location->owned_index = country->owned_locations->size();
+    country->owned_locations->push_back(location);
+    country_slot = sim.countries.IndexOf(*country);
+  }
+  sim.aggregates.SetOwner(sim.locations.IndexOf(*location), country_slot);
 }
 
-void Init(Sim& sim) {
+void TransferAll(Sim& sim, Country& from, Country& to) {
+  if (&from == &to) {
+    return;
+  }
+  auto& source = *from.owned_locations;
+  auto& target = *to.owned_locations;
+  u32 to_slot = sim.countries.IndexOf(to);
+  target.reserve(target.size() + source.size());
+  sim.countries.Touch(from);
+  sim.countries.Touch(to);
+  for (auto* location : source) {
+    sim.locations.Touch(*location);
+    location->owner_country = &to;
+    location->owned_index = target.size();
+    target.push_back(location);
+    sim.aggregates.SetOwner(sim.locations.IndexOf(*location), to_slot);
+  }
+  source.clear();
+}
+
+static inline void AdvanceDate(Date& date) {
+  auto old_date = date.epoch;
+  date.epoch++;
+  assert(date.epoch > old_date);
+}
+
+namespace systems {
+
+static void AdvanceDate(Sim& sim, const TickRequest& request, Range range) {
+  if (request.advance_time) {
+    simulation::AdvanceDate(sim.date);
+  }
+}
+
+static usize CountLocations(const Sim& sim) {
+  // Capacity rather than live count, so bucket boundaries never move
+  return sim.locations.Capacity();
+}
+
+// Monthly growth. Each location is visited once per month.
+static void PopGrowth(Sim& sim, const TickRequest& request, Range range) {
+  const f64 years = f64(DAYS_PER_MONTH) / f64(DAYS_PER_YEAR);
+  for (usize idx = range.begin; idx < range.end; ++idx) {
+    const auto& location = sim.locations[idx];
+    if (!IsValid(location)) {
+      continue;
+    }
+    i64 grown = 0;
+    for (auto* pop : *location.pops_at_location) {
+      auto rng = rng::Philox(sim.seed, sim.date.epoch,
+          rng::EntityKey(sim.pops.IndexOf(*pop), pop->generation),
+          rng::Stream::PopGrowth);
+      f64 spread = pop->type->growth_spread;
+      f64 rate = pop->type->growth * rng.Uniform(1.0 - spread, 1.0 + spread);
+      f64 growth = pop->size * rate * years + pop->growth_carry;
+      f64 whole = std::floor(growth);
+      sim.pops.Touch(*pop);
+      pop->size += i64(whole);
+      pop->growth_carry = growth - whole;
+      grown += i64(whole);
+    }
+    if (grown != 0) {
+      sim.aggregates.Record(idx, {.population = grown});
+    }
+  }
+}
+
+// Fires the events due today. Runs after AdvanceDate.
+static void FireEvents(Sim& sim, const TickRequest& request, Range range) {
+  auto& commands = sim.commands.Local();
+  sim.events.Advance(sim.date.epoch, [&](const Event& event) {
+    auto target = Resolve(event.target);
+    if (!target.IsValid()) {
+      return;
+    }
+    switch (event.kind) {
+    case EventKind::BuildingComplete: {
+      auto* building = (Building*)target.handle;
+      auto before = TotalsOf(*building);
+      sim.buildings.Touch(*building);
+      building->size += event.amount;
+      auto delta = TotalsOf(*building);
+      delta -= before;
+      sim.aggregates.Record(sim.locations.IndexOf(*building->location), delta);
+      break;
+    }
+    case EventKind::PopMigrate: {
+      auto destination = Resolve(event.destination);
+      if (destination.kind != EntityIdKind::Location || !destination.IsValid()) {
+        break;
+      }
+      auto* pop = (Pop*)target.handle;
+      commands.MovePop(
+          sim.pops.IndexOf(*pop), pop, (Location*)destination.handle);
+      break;
+    }
+    }
+  });
+}
+
+// Share of building revenue paid out as wages to the pops at its location
+static const f64 WAGE_SHARE = 0.6;
+// Share of wages paid as tax to the owner of the location
+static const f64 TAX_RATE = 0.1;
+
+// Buildings sell their output to the world at local prices, pay wages to
+// the pops at their location by size, and pops pay tax on their wages.
+static void PayIncome(Sim& sim, const TickRequest& request, Range range) {
+  auto& ledger = sim.ledger.Local();
+  const auto& markets = sim.markets;
+  for (usize idx = range.begin; idx < range.end; ++idx) {
+    const auto& location = sim.locations[idx];
+    if (!IsValid(location)) {
+      continue;
+    }
+    i64 workers = 0;
+    for (const auto* pop : *location.pops_at_location) {
+      workers += pop->size;
+    }
+    Money gdp = 0;
+
+    for (const auto* building : *location.buildings_at_location) {
+      f64 revenue = 0.0;
+      for (usize good = 0; good < markets.num_goods; ++good) {
+        revenue += building->type->output[good] * building->size *
+                   markets.price[markets.At(idx, good)];
+      }
+      auto building_account = AccountOf(sim, *building);
+      ledger.Transfer(WorldAccount(), building_account, ToMoney(revenue));
+      gdp += ToMoney(revenue);
+      if (workers <= 0) {
+        continue;
+      }
+
+      Money wages = ToMoney(revenue * WAGE_SHARE);
+      for (const auto* pop : *location.pops_at_location) {
+        auto pop_account = AccountOf(sim, *pop);
+        Money wage = wages * pop->size / workers;
+        ledger.Transfer(building_account, pop_account, wage);
+        if (location.owner_country) {
+          ledger.Transfer(pop_account, AccountOf(sim, *location.owner_country),
+              Money(f64(wage) * TAX_RATE));
+        }
+      }
+    }
+
+    Money gdp_delta = gdp - sim.aggregates.AtLocation(idx).gdp;
+    if (gdp_delta != 0) {
+      sim.aggregates.Record(idx, {.gdp = gdp_delta});
+    }
+  }
+}
+
+} // namespace systems
+
+static inline void RegisterSystems(Sim& sim) {
+  sim.systems.Register(System{
+      .name = "AdvanceDate",
+      .reads = {},
+      .writes = {Resource::Date},
+      .run = systems::AdvanceDate,
+  });
+  sim.systems.Register(System{
+      .name = "PopGrowth",
+      // The growth RNG is keyed on the date
+      .reads = {Resource::Date, Resource::Locations},
+      .writes = {Resource::Pops},
+      .run = systems::PopGrowth,
+      .count = systems::CountLocations,
+      .chunk_size = 64,
+      .period = DAYS_PER_MONTH,
+  });
+  sim.systems.Register(System{
+      .name = "FireEvents",
+      .reads = {Resource::Date},
+      .writes = {Resource::Events, Resource::Pops, Resource::Buildings},
+      .run = systems::FireEvents,
+  });
+  sim.systems.Register(System{
+      .name = "UpdateNetwork",
+      .reads = {Resource::Locations},
+      .writes = {Resource::Network},
+      .run = UpdateNetwork,
+  });
+  sim.systems.Register(System{
+      .name = "ComputeMarkets",
+      .reads = {Resource::Locations, Resource::Pops, Resource::Buildings},
+      .writes = {Resource::Markets},
+      .run = ComputeMarkets,
+      .count = CountMarkets,
+      .chunk_size = 256,
+  });
+  sim.systems.Register(System{
+      .name = "SolveTrade",
+      .reads = {Resource::Locations, Resource::Network},
+      .writes = {Resource::Markets, Resource::Trade},
+      .run = SolveTrade,
+  });
+  // Transfers only go through the ledger, so nothing is written here
+  sim.systems.Register(System{
+      .name = "PayIncome",
+      .reads = {Resource::Locations, Resource::Pops, Resource::Buildings,
+          Resource::Markets},
+      .writes = {},
+      .run = systems::PayIncome,
+      .count = systems::CountLocations,
+      .chunk_size = 256,
+  });
+}
+
+void InitEmpty(Sim& sim) {
   using namespace init_sim;
   InitGoodTypes(sim);
   InitPopTypes(sim);
@@ -285,7 +498,17 @@ void Init(Sim& sim) {
   sim.buildings = std::move(Buildings("Buildings", 2048));
   sim.countries = std::move(Countries("Countries", 256));
   sim.locations = std::move(Locations("Locations", 1024));
+  sim.commands.Init(jobs::NumThreads());
+  sim.ledger.Init(jobs::NumThreads());
+  sim.aggregates.Init(sim.locations.Capacity(), sim.countries.Capacity(),
+      jobs::NumThreads());
+  sim.events.Reset(sim.date.epoch);
+  sim.markets.Init(sim.locations.Capacity(), sim.good_types.size());
+
+  RegisterSystems(sim);
+}
 
+void InitScenario(Sim& sim) {
   {
     auto tag_name = TagAndName{
         .tag = "italy",
@@ -308,22 +531,111 @@ void Init(Sim& sim) {
   }
 
   {
-    PopInit(sim, "peasants", "rome", 200);
-    PopInit(sim, "burghers", "rome", 100);
+    auto tag_name = TagAndName{
+        .tag = "naples",
+        .name = "Naples",
+    };
+    auto* location = LocationInit(sim, tag_name, {1.5, 1.0});
+    assume_valid(location);
+    ChangeLocationOwner(sim, sim.player.country, location);
+  }
+
+  {
+    auto tag_name = TagAndName{
+        .tag = "milan",
+        .name = "Milan",
+    };
+    auto* location = LocationInit(sim, tag_name, {-1.0, -2.0});
+    assume_valid(location);
+    ChangeLocationOwner(sim, sim.player.country, location);
+  }
+
+  {
     BuildingInit(sim, "farm", "rome", 1);
+    BuildingInit(sim, "farm", "naples", 3);
+  }
+
+  {
+    struct Desc {
+      const char* type{""};
+      const char* location{""};
+      i64 size{0};
+    };
+    const auto descs = std::to_array({
+        Desc{"peasants", "rome", 200},
+        Desc{"burghers", "rome", 100},
+        Desc{"peasants", "naples", 100},
+        Desc{"burghers", "milan", 300},
+    });
+
+    PopBatch batch;
+    batch.Reserve(descs.size());
+    for (const auto& desc : descs) {
+      batch.Push(FindPopType(sim, desc.type), FindLocation(sim, desc.location),
+          desc.size);
+    }
+    auto result = SpawnPops(sim, batch);
+    for (const auto& error : result.errors) {
+      const auto& desc = descs[error.row];
+      std::cout << "Could not spawn " << desc.type << " at " << desc.location
+                << ": " << ToString(error.kind) << std::endl;
+    }
+  }
+
+  {
+    ConnectLocations(sim, "rome", "naples", 2.0);
+    ConnectLocations(sim, "rome", "milan", 5.0);
   }
 }
 
-static inline void AdvanceDate(Date& date) {
-  auto old_date = date.epoch;
-  date.epoch++;
-  assert(date.epoch > old_date);
+void Init(Sim& sim) {
+  InitEmpty(sim);
+  InitScenario(sim);
+}
+
+// Deferred work applied once all systems of the tick are done
+static void FinishTick(Sim& sim) {
+  ApplyLedger(sim);
+  sim.aggregates.Flush();
+  ApplyCommands(sim);
+  // Catches any duplicate cohorts merge on insert missed
+  if (sim.date.epoch % DAYS_PER_MONTH == 0) {
+    MergeAllCohorts(sim);
+  }
 }
 
 void Tick(Sim& sim, const simulation::TickRequest& request) {
-  if (request.advance_time) {
-    AdvanceDate(sim.date);
+  sim.systems.Run(sim, request);
+  FinishTick(sim);
+}
+
+TimerHandle ScheduleEvent(Sim& sim, u64 days, Event event) {
+  return sim.events.Schedule(sim.date.epoch + days, event);
+}
+
+bool CancelEvent(Sim& sim, TimerHandle handle) {
+  return sim.events.Cancel(handle);
+}
+
+void SetConnectionCost(Sim& sim, Location& a, Location& b, f64 cost) {
+  u32 a_idx = sim.locations.IndexOf(a);
+  u32 b_idx = sim.locations.IndexOf(b);
+  f64 old_cost = sim.location_graph.SetCost(a_idx, b_idx, cost);
+  if (old_cost >= 0.0) {
+    sim.paths.OnCostChanged(a_idx, b_idx, old_cost, cost);
+  }
+}
+
+bool TickSlice(Sim& sim, const TickRequest& request,
+    Scheduler::Clock::time_point deadline) {
+  if (!sim.systems.InProgress()) {
+    sim.systems.Begin(sim);
   }
+  if (!sim.systems.Step(sim, request, deadline)) {
+    return false;
+  }
+  FinishTick(sim);
+  return true;
 }
 
 List<MapItem> ViewMapItems(const Sim& sim, Arena& arena) {
@@ -336,6 +648,7 @@ List<MapItem> ViewMapItems(const Sim& sim, Arena& arena) {
     MapItem item;
     if (location.owner_country) {
       item.color = location.owner_country->color;
+      item.owner = u32(sim.countries.IndexOf(*location.owner_country));
     }
     item.id = EntityId {
         .kind = EntityIdKind::Location,
@@ -372,6 +685,7 @@ const char*  Write(ExtractCtx& ctx, T value) {
 
 static inline Object* Info(ExtractCtx& ctx, const Pop& pop) {
   auto* obj = NewObject(ctx);
+  obj->id = IdOf(pop);
   obj->strings.Set(Field::Name, pop.type->name.c_str());
   obj->strings.Set(Field::Size, Write(ctx, pop.size));
   return obj;
@@ -379,11 +693,7 @@ static inline Object* Info(ExtractCtx& ctx, const Pop& pop) {
 
 static inline Object* Info(ExtractCtx& ctx, const Building& building) {
   auto* obj = NewObject(ctx);
-  obj->id = EntityId {
-    .kind = EntityIdKind::Building,
-    .generation = building.generation,
-    .handle = (&building)
-  };
+  obj->id = IdOf(building);
   obj->strings.Set(Field::Name, building.type->name.c_str());
   obj->strings.Set(Field::Size, Write(ctx, building.size));
   return obj;
@@ -400,6 +710,23 @@ static inline void Extract(
     }
   }
 
+  {
+    const auto& aggregates = ctx.sim.aggregates;
+    const auto& totals =
+        aggregates.AtLocation(ctx.sim.locations.IndexOf(location));
+    obj.strings.Set(Field::Population, Write(ctx, totals.population));
+    obj.strings.Set(Field::Output, Write(ctx, totals.output));
+    obj.strings.Set(Field::Gdp, Write(ctx, f64(totals.gdp) / MONEY_UNIT));
+    if (auto* country = location.owner_country) {
+      const auto& country_totals =
+          aggregates.AtCountry(ctx.sim.countries.IndexOf(*country));
+      obj.strings.Set(
+          Field::CountryPopulation, Write(ctx, country_totals.population));
+      obj.strings.Set(
+          Field::CountryGdp, Write(ctx, f64(country_totals.gdp) / MONEY_UNIT));
+    }
+  }
+
   // Pops
   {
     auto list = List<Object*>(&ctx.arena);
@@ -425,6 +752,11 @@ void Extract(ExtractCtx& ctx, Object& obj, const Building& building) {
   obj.strings.Set(Field::Size, Write(ctx, building.size));
 }
 
+static inline void Extract(ExtractCtx& ctx, Object& obj, const Pop& pop) {
+  obj.strings.Set(Field::Name, pop.type->name.c_str());
+  obj.strings.Set(Field::Size, Write(ctx, pop.size));
+}
+
 Object* Extract(ExtractCtx& ctx, EntityId id) {
   Object* obj = NewObject(ctx);
   obj->id = id;
@@ -440,6 +772,9 @@ Object* Extract(ExtractCtx& ctx, EntityId id) {
   case EntityIdKind::Building:
     Extract(ctx, *obj, *(Building*)id.handle);
     break;
+  case EntityIdKind::Pop:
+    Extract(ctx, *obj, *(Pop*)id.handle);
+    break;
   case EntityIdKind::INVALID:
     break;
   }
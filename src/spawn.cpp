@@ -0,0 +1,231 @@
+#include <spawn.h>
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+
+#include <jobs.h>
+#include <simulation.h>
+
+namespace simulation {
+
+// Rows handled per parallel task
+static const usize SPAWN_CHUNK = 4096;
+
+u32 FindPopType(const Sim& sim, std::string_view tag) {
+  for (usize idx = 0; idx < sim.pop_types.size(); ++idx) {
+    if (sim.pop_types[idx].tag == tag) {
+      return idx;
+    }
+  }
+  return NOT_FOUND;
+}
+
+u32 FindLocation(const Sim& sim, std::string_view tag) {
+  for (usize idx = 0; idx < sim.locations.Capacity(); ++idx) {
+    const auto& location = sim.locations[idx];
+    if (IsValid(location) && location.tag == tag) {
+      return idx;
+    }
+  }
+  return NOT_FOUND;
+}
+
+const char* ToString(SpawnErrorKind kind) {
+  switch (kind) {
+  case SpawnErrorKind::InvalidType:
+    return "invalid type";
+  case SpawnErrorKind::InvalidLocation:
+    return "invalid location";
+  case SpawnErrorKind::InvalidSize:
+    return "invalid size";
+  case SpawnErrorKind::OutOfSpace:
+    return "out of space";
+  }
+  return "unknown";
+}
+
+static inline void For(
+    bool parallel, usize begin, usize end, const jobs::RangeTask& task) {
+  if (parallel) {
+    jobs::ParallelFor(begin, end, SPAWN_CHUNK, task);
+  } else {
+    task(begin, end);
+  }
+}
+
+SpawnResult SpawnPops(Sim& sim, const PopBatch& batch, bool parallel) {
+  SpawnResult result;
+  usize num_rows = batch.Size();
+  assert(batch.locations.size() == num_rows && batch.sizes.size() == num_rows);
+  if (num_rows == 0) {
+    return result;
+  }
+
+  // Validate every row. Errors go to per-chunk lists that are merged in
+  // chunk order, so they come out sorted by row.
+  std::vector<u8> valid(num_rows, 0);
+  usize num_chunks = (num_rows + SPAWN_CHUNK - 1) / SPAWN_CHUNK;
+  std::vector<std::vector<SpawnError>> chunk_errors(num_chunks);
+  For(parallel, 0, num_rows, [&](usize begin, usize end) {
+    auto& errors = chunk_errors[begin / SPAWN_CHUNK];
+    for (usize row = begin; row < end; ++row) {
+      u32 location = batch.locations[row];
+      if (batch.types[row] >= sim.pop_types.size()) {
+        errors.push_back({row, SpawnErrorKind::InvalidType});
+      } else if (location >= sim.locations.Capacity() ||
+                 !IsValid(sim.locations[location])) {
+        errors.push_back({row, SpawnErrorKind::InvalidLocation});
+      } else if (batch.sizes[row] <= 0) {
+        errors.push_back({row, SpawnErrorKind::InvalidSize});
+      } else {
+        valid[row] = 1;
+      }
+    }
+  });
+  for (auto& errors : chunk_errors) {
+    result.errors.insert(result.errors.end(), errors.begin(), errors.end());
+  }
+
+  // Groups rows by location, keeping row order within each location, so
+  // every location can be handled by one task
+  usize num_locations = sim.locations.Capacity();
+  auto group = [&](const std::vector<u32>& rows, std::vector<u32>& offsets,
+                   std::vector<u32>& grouped) {
+    offsets.assign(num_locations + 1, 0);
+    for (u32 row : rows) {
+      offsets[batch.locations[row] + 1]++;
+    }
+    for (usize idx = 0; idx < num_locations; ++idx) {
+      offsets[idx + 1] += offsets[idx];
+    }
+    grouped.resize(rows.size());
+    auto fill = offsets;
+    for (u32 row : rows) {
+      grouped[fill[batch.locations[row]]++] = row;
+    }
+  };
+
+  std::vector<u32> valid_rows;
+  valid_rows.reserve(num_rows);
+  for (usize row = 0; row < num_rows; ++row) {
+    if (valid[row]) {
+      valid_rows.push_back(row);
+    }
+  }
+  std::vector<u32> offsets;
+  std::vector<u32> grouped;
+  group(valid_rows, offsets, grouped);
+
+  // Merge on insert: a row joins the pop of its type already at the
+  // location, or else the first row of its type, which creates the pop
+  static const u32 NONE = std::numeric_limits<u32>::max();
+  std::vector<u32> cohort(num_rows, NONE);
+  std::vector<i64> cohort_size(num_rows, 0);
+  std::vector<i64> population(num_locations, 0);
+  usize num_types = sim.pop_types.size();
+  For(parallel, 0, num_locations, [&](usize begin, usize end) {
+    std::vector<Pop*> existing(num_types, nullptr);
+    std::vector<u32> first(num_types, NONE);
+    for (usize idx = begin; idx < end; ++idx) {
+      if (offsets[idx] == offsets[idx + 1]) {
+        continue;
+      }
+      const auto& list = *sim.locations[idx].pops_at_location;
+      for (auto* pop : list) {
+        auto*& slot = existing[pop->type->id.idx];
+        slot = slot ? slot : pop;
+      }
+      for (u32 i = offsets[idx]; i < offsets[idx + 1]; ++i) {
+        u32 row = grouped[i];
+        u32 type = batch.types[row];
+        if (auto* pop = existing[type]) {
+          sim.pops.Touch(*pop);
+          pop->size += batch.sizes[row];
+          population[idx] += batch.sizes[row];
+          continue;
+        }
+        if (first[type] == NONE) {
+          first[type] = row;
+        }
+        cohort[row] = first[type];
+        cohort_size[first[type]] += batch.sizes[row];
+      }
+      for (auto* pop : list) {
+        existing[pop->type->id.idx] = nullptr;
+      }
+      for (u32 i = offsets[idx]; i < offsets[idx + 1]; ++i) {
+        first[batch.types[grouped[i]]] = NONE;
+      }
+    }
+  });
+
+  // Take pool slots for as many new cohorts as fit, in row order. Rows that
+  // would have joined a cohort that did not fit fail with it.
+  std::vector<u32> creators;
+  std::vector<u8> placed(num_rows, 0);
+  usize free_slots = sim.pops.Capacity() - sim.pops.NumAllocated();
+  for (u32 row : valid_rows) {
+    u32 creator = cohort[row];
+    if (creator == NONE) {
+      result.spawned++;
+      continue;
+    }
+    if (creator == row && creators.size() < free_slots) {
+      creators.push_back(row);
+      placed[row] = 1;
+    }
+    if (placed[creator]) {
+      result.spawned++;
+    } else {
+      result.errors.push_back({row, SpawnErrorKind::OutOfSpace});
+    }
+  }
+  std::sort(result.errors.begin(), result.errors.end(),
+      [](const auto& a, const auto& b) { return a.row < b.row; });
+
+  std::vector<Pop*> pops(num_rows, nullptr);
+  for (u32 row : creators) {
+    pops[row] = &sim.pops.Allocate();
+  }
+
+  For(parallel, 0, creators.size(), [&](usize begin, usize end) {
+    for (usize i = begin; i < end; ++i) {
+      u32 row = creators[i];
+      auto& pop = *pops[row];
+      pop.generation++;
+      pop.type = &sim.pop_types[batch.types[row]];
+      pop.size = cohort_size[row];
+      pop.location = &sim.locations[batch.locations[row]];
+    }
+  });
+
+  // Every location list grows exactly once
+  group(creators, offsets, grouped);
+  For(parallel, 0, num_locations, [&](usize begin, usize end) {
+    for (usize idx = begin; idx < end; ++idx) {
+      if (offsets[idx] == offsets[idx + 1]) {
+        continue;
+      }
+      sim.locations.Touch(sim.locations[idx]);
+      auto& list = *sim.locations[idx].pops_at_location;
+      list.reserve(list.size() + offsets[idx + 1] - offsets[idx]);
+      for (u32 i = offsets[idx]; i < offsets[idx + 1]; ++i) {
+        auto* pop = pops[grouped[i]];
+        list.push_back(pop);
+        population[idx] += pop->size;
+      }
+    }
+  });
+
+  for (usize idx = 0; idx < num_locations; ++idx) {
+    if (population[idx] != 0) {
+      sim.aggregates.Add(idx, {.population = population[idx]});
+    }
+  }
+
+  result.created = creators.size();
+  return result;
+}
+
+} // namespace simulation
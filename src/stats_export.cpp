@@ -0,0 +1,329 @@
+#include <stats_export.h>
+
+#include <bit>
+#include <cassert>
+#include <cstring>
+#include <iostream>
+#include <limits>
+
+#include <simulation.h>
+
+// Deflate from the copies vendored with raylib, which also builds them
+extern "C" {
+#include <external/sdefl.h>
+#include <external/sinfl.h>
+}
+
+namespace simulation {
+
+static const char STATS_MAGIC[8] = {'E', 'C', 'O', 'N', 'S', 'T', 'A', 'T'};
+static const u32 STATS_VERSION = 1;
+// Speed over ratio; the XOR pass does most of the work
+static const int STATS_DEFLATE_LEVEL = SDEFL_LVL_MIN;
+static const usize NAME_SIZE = 32;
+// Keeps one chunk within what sdefl can address
+static const u64 MAX_CHUNK_BYTES = u64(std::numeric_limits<int>::max() / 2);
+
+struct StatsFileHeader {
+  char magic[8];
+  u32 version{0};
+  u32 num_columns{0};
+};
+
+struct ColumnHeader {
+  char name[NAME_SIZE]{};
+  StatsKind kind{StatsKind::F64};
+  u32 reserved{0};
+  u64 width{0};
+};
+
+struct StatsBlockHeader {
+  u64 first_tick{0};
+  u32 num_rows{0};
+  u32 num_columns{0};
+};
+
+struct StatsChunkHeader {
+  u64 raw_size{0};
+  u64 packed_size{0};
+};
+
+// Column layout and where each column's values come from. Shared by Open
+// and Append, so the two cannot disagree.
+template <typename F> static void ForEachColumn(const Sim& sim, F fn) {
+  usize num_locations = sim.locations.Capacity();
+  usize num_countries = sim.countries.Capacity();
+  const auto& aggregates = sim.aggregates;
+  fn("day", StatsKind::U64, 1, [&](usize) { return sim.date.epoch; });
+  fn("price", StatsKind::F64, sim.markets.price.size(),
+      [&](usize at) { return std::bit_cast<u64>(sim.markets.price[at]); });
+  fn("location_population", StatsKind::I64, num_locations, [&](usize location) {
+    return u64(aggregates.AtLocation(location).population);
+  });
+  fn("location_output", StatsKind::F64, num_locations, [&](usize location) {
+    return std::bit_cast<u64>(aggregates.AtLocation(location).output);
+  });
+  fn("country_population", StatsKind::I64, num_countries, [&](usize country) {
+    return u64(aggregates.AtCountry(country).population);
+  });
+  fn("country_output", StatsKind::F64, num_countries, [&](usize country) {
+    return std::bit_cast<u64>(aggregates.AtCountry(country).output);
+  });
+}
+
+StatsExport::~StatsExport() {
+  if (this->file) {
+    this->Close();
+  }
+}
+
+bool StatsExport::Open(const char* path, const Sim& sim, usize rows_per_block) {
+  assert(!this->file && rows_per_block > 0);
+  this->columns.clear();
+  ForEachColumn(sim, [&](const char* name, StatsKind kind, usize width, auto) {
+    this->columns.push_back({name, kind, width});
+  });
+  for (const auto& column : this->columns) {
+    if (column.width * rows_per_block * sizeof(u64) > MAX_CHUNK_BYTES) {
+      std::cout << "Stats column '" << column.name << "' is too wide" << std::endl;
+      return false;
+    }
+  }
+
+  this->file = std::fopen(path, "wb");
+  if (!this->file) {
+    std::cout << "Could not open stats export '" << path << "'" << std::endl;
+    return false;
+  }
+  StatsFileHeader header{
+      .version = STATS_VERSION,
+      .num_columns = u32(this->columns.size()),
+  };
+  std::memcpy(header.magic, STATS_MAGIC, sizeof(STATS_MAGIC));
+  bool ok = std::fwrite(&header, sizeof(header), 1, this->file) == 1;
+  for (const auto& column : this->columns) {
+    ColumnHeader column_header{.kind = column.kind, .width = column.width};
+    std::strncpy(column_header.name, column.name.c_str(), NAME_SIZE - 1);
+    ok = ok && std::fwrite(&column_header, sizeof(column_header), 1, this->file) == 1;
+  }
+  if (!ok) {
+    std::cout << "Failed writing stats export '" << path << "'" << std::endl;
+    std::fclose(this->file);
+    this->file = nullptr;
+    return false;
+  }
+
+  this->rows_per_block = rows_per_block;
+  for (auto& block : this->blocks) {
+    block.num_rows = 0;
+    block.columns.resize(this->columns.size());
+    for (usize i = 0; i < this->columns.size(); ++i) {
+      block.columns[i].assign(this->columns[i].width * rows_per_block, 0);
+    }
+  }
+  this->filling = &this->blocks[0];
+  this->full = nullptr;
+  this->quit = false;
+  this->failed = false;
+  this->stats = {};
+  this->writer = std::thread([this] { this->WriterMain(); });
+  return true;
+}
+
+void StatsExport::Append(const Sim& sim) {
+  if (!this->file) {
+    return;
+  }
+  auto& block = *this->filling;
+  usize row = block.num_rows;
+  usize column = 0;
+  ForEachColumn(sim, [&](const char*, StatsKind, usize width, auto value_of) {
+    assert(width == this->columns[column].width);
+    u64* out = block.columns[column].data() + row * width;
+    for (usize i = 0; i < width; ++i) {
+      out[i] = value_of(i);
+    }
+    column++;
+  });
+  block.num_rows++;
+
+  std::unique_lock lock(this->mutex);
+  if (block.num_rows == 1) {
+    block.first_tick = this->stats.ticks;
+  }
+  this->stats.ticks++;
+  if (block.num_rows == this->rows_per_block) {
+    this->Hand(lock, &block);
+  }
+}
+
+// Passes a block to the writer and starts filling the other one. Waits if
+// the writer has not finished with it yet.
+void StatsExport::Hand(std::unique_lock<std::mutex>& lock, Block* block) {
+  if (this->full) {
+    this->stats.stalls++;
+    this->changed.wait(lock, [&] { return !this->full; });
+  }
+  this->full = block;
+  this->filling = block == &this->blocks[0] ? &this->blocks[1] : &this->blocks[0];
+  this->filling->num_rows = 0;
+  this->changed.notify_all();
+}
+
+void StatsExport::WriterMain() {
+  auto state = std::make_unique<sdefl>();
+  std::vector<u64> delta;
+  std::vector<byte> packed;
+  while (true) {
+    Block* block = nullptr;
+    {
+      std::unique_lock lock(this->mutex);
+      this->changed.wait(lock, [&] { return this->full || this->quit; });
+      if (!this->full) {
+        return;
+      }
+      block = this->full;
+    }
+    bool ok = this->WriteBlock(*block, delta, packed, state.get());
+    {
+      std::lock_guard lock(this->mutex);
+      this->failed = this->failed || !ok;
+      this->stats.blocks++;
+      this->full = nullptr;
+    }
+    this->changed.notify_all();
+  }
+}
+
+bool StatsExport::WriteBlock(Block& block, std::vector<u64>& delta,
+    std::vector<byte>& packed, sdefl* state) {
+  StatsBlockHeader header{
+      .first_tick = block.first_tick,
+      .num_rows = u32(block.num_rows),
+      .num_columns = u32(this->columns.size()),
+  };
+  bool ok = std::fwrite(&header, sizeof(header), 1, this->file) == 1;
+  u64 raw_bytes = 0;
+  u64 written_bytes = sizeof(header);
+  for (usize i = 0; ok && i < this->columns.size(); ++i) {
+    usize width = this->columns[i].width;
+    usize count = width * block.num_rows;
+    const u64* values = block.columns[i].data();
+    delta.resize(count);
+    for (usize at = 0; at < count; ++at) {
+      delta[at] = at < width ? values[at] : values[at] ^ values[at - width];
+    }
+
+    StatsChunkHeader chunk{.raw_size = count * sizeof(u64)};
+    packed.resize(sdefl_bound(int(chunk.raw_size)));
+    chunk.packed_size = sdeflate(state, packed.data(),
+        delta.data(), int(chunk.raw_size), STATS_DEFLATE_LEVEL);
+    ok = std::fwrite(&chunk, sizeof(chunk), 1, this->file) == 1 &&
+         std::fwrite(packed.data(), 1, chunk.packed_size, this->file) ==
+             chunk.packed_size;
+    raw_bytes += chunk.raw_size;
+    written_bytes += sizeof(chunk) + chunk.packed_size;
+  }
+  std::lock_guard lock(this->mutex);
+  this->stats.raw_bytes += raw_bytes;
+  this->stats.written_bytes += written_bytes;
+  return ok;
+}
+
+bool StatsExport::Close() {
+  if (!this->file) {
+    return false;
+  }
+  {
+    std::unique_lock lock(this->mutex);
+    if (this->filling->num_rows > 0) {
+      this->Hand(lock, this->filling);
+    }
+    this->quit = true;
+  }
+  this->changed.notify_all();
+  this->writer.join();
+  bool ok = !this->failed;
+  ok = (std::fclose(this->file) == 0) && ok;
+  this->file = nullptr;
+  if (!ok) {
+    std::cout << "Failed writing stats export" << std::endl;
+  }
+  return ok;
+}
+
+StatsExportStats StatsExport::Stats() {
+  std::lock_guard lock(this->mutex);
+  return this->stats;
+}
+
+bool ReadStatsColumn(const char* path, const char* name, StatsColumn& column,
+    std::vector<u64>& values) {
+  FILE* file = std::fopen(path, "rb");
+  if (!file) {
+    std::cout << "Could not open stats export '" << path << "'" << std::endl;
+    return false;
+  }
+  values.clear();
+  StatsFileHeader header;
+  bool ok = std::fread(&header, sizeof(header), 1, file) == 1 &&
+            std::memcmp(header.magic, STATS_MAGIC, sizeof(STATS_MAGIC)) == 0 &&
+            header.version == STATS_VERSION;
+  usize index = header.num_columns;
+  std::vector<ColumnHeader> column_headers(ok ? header.num_columns : 0);
+  for (usize i = 0; ok && i < column_headers.size(); ++i) {
+    auto& column_header = column_headers[i];
+    ok = std::fread(&column_header, sizeof(column_header), 1, file) == 1;
+    column_header.name[NAME_SIZE - 1] = '\0';
+    if (ok && index == header.num_columns &&
+        std::strcmp(column_header.name, name) == 0) {
+      index = i;
+      column = {column_header.name, column_header.kind, column_header.width};
+    }
+  }
+  if (ok && index == header.num_columns) {
+    std::cout << "Stats export '" << path << "' has no column '" << name << "'"
+              << std::endl;
+    std::fclose(file);
+    return false;
+  }
+
+  std::vector<byte> packed;
+  std::vector<u64> raw;
+  StatsBlockHeader block;
+  while (ok && std::fread(&block, sizeof(block), 1, file) == 1) {
+    ok = block.num_columns == header.num_columns;
+    for (usize i = 0; ok && i < block.num_columns; ++i) {
+      StatsChunkHeader chunk;
+      ok = std::fread(&chunk, sizeof(chunk), 1, file) == 1 &&
+           chunk.raw_size ==
+               column_headers[i].width * block.num_rows * sizeof(u64) &&
+           chunk.raw_size <= MAX_CHUNK_BYTES &&
+           chunk.packed_size <= u64(sdefl_bound(int(chunk.raw_size)));
+      if (!ok) {
+        break;
+      }
+      if (i != index) {
+        ok = std::fseek(file, long(chunk.packed_size), SEEK_CUR) == 0;
+        continue;
+      }
+      packed.resize(chunk.packed_size);
+      raw.resize(chunk.raw_size / sizeof(u64));
+      ok = std::fread(packed.data(), 1, packed.size(), file) == packed.size() &&
+           u64(sinflate(raw.data(), int(chunk.raw_size), packed.data(),
+               int(packed.size()))) == chunk.raw_size;
+      usize width = column.width;
+      for (usize at = width; ok && at < raw.size(); ++at) {
+        raw[at] ^= raw[at - width];
+      }
+      values.insert(values.end(), raw.begin(), raw.end());
+    }
+  }
+  std::fclose(file);
+  if (!ok) {
+    std::cout << "Stats export '" << path << "' is invalid" << std::endl;
+  }
+  return ok;
+}
+
+} // namespace simulation
@@ -0,0 +1,539 @@
+#include <trade.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <queue>
+#include <utility>
+
+#include <jobs.h>
+#include <simulation.h>
+
+namespace simulation {
+
+// Pop demand is given per this many people
+static const f64 POP_DEMAND_UNIT = 100.0;
+// Local prices stay within these multiples of the base price
+static const f64 MIN_PRICE_FACTOR = 0.25;
+static const f64 MAX_PRICE_FACTOR = 4.0;
+// Routing rounds per region before the solver settles for what it has
+static const usize MAX_ROUTING_ROUNDS = 16;
+// Markets a repair search settles before giving up on the rest
+static const usize MAX_REPAIR_SETTLED = 256;
+// Once more than one market in this many of a region was repaired since its
+// last full solve, it is solved in full again, which bounds how far repairs
+// drift from a whole solution
+static const usize FULL_SOLVE_SHARE = 8;
+static const f64 EPSILON = 1e-9;
+static const f64 INF = std::numeric_limits<f64>::infinity();
+static const u32 NIL = LocationGraph::NIL;
+
+void LocationGraph::Build(usize num_nodes) {
+  if (!this->dirty && this->num_nodes == num_nodes) {
+    return;
+  }
+  this->num_nodes = num_nodes;
+
+  // CSR adjacency, both directions of every edge
+  this->offsets.assign(num_nodes + 1, 0);
+  for (const auto& edge : this->edges) {
+    assert(edge.a < num_nodes && edge.b < num_nodes);
+    this->offsets[edge.a + 1]++;
+    this->offsets[edge.b + 1]++;
+  }
+  for (usize i = 0; i < num_nodes; ++i) {
+    this->offsets[i + 1] += this->offsets[i];
+  }
+  this->targets.resize(this->offsets[num_nodes]);
+  this->costs.resize(this->offsets[num_nodes]);
+  this->edge_of.resize(this->offsets[num_nodes]);
+  {
+    auto fill = this->offsets;
+    for (u32 idx = 0; idx < this->edges.size(); ++idx) {
+      const auto& edge = this->edges[idx];
+      this->targets[fill[edge.a]] = edge.b;
+      this->edge_of[fill[edge.a]] = idx;
+      this->costs[fill[edge.a]++] = edge.cost;
+      this->targets[fill[edge.b]] = edge.a;
+      this->edge_of[fill[edge.b]] = idx;
+      this->costs[fill[edge.b]++] = edge.cost;
+    }
+  }
+
+  // Components by flood fill, numbered in order of their lowest node
+  this->component_of.assign(num_nodes, NIL);
+  this->component_offsets.assign(1, 0);
+  this->component_nodes.clear();
+  this->component_nodes.reserve(num_nodes);
+  for (u32 root = 0; root < num_nodes; ++root) {
+    if (this->component_of[root] != NIL) {
+      continue;
+    }
+    u32 component = this->component_offsets.size() - 1;
+    usize begin = this->component_nodes.size();
+    this->component_of[root] = component;
+    this->component_nodes.push_back(root);
+    for (usize i = begin; i < this->component_nodes.size(); ++i) {
+      u32 node = this->component_nodes[i];
+      for (u32 next : this->Targets(node)) {
+        if (this->component_of[next] == NIL) {
+          this->component_of[next] = component;
+          this->component_nodes.push_back(next);
+        }
+      }
+    }
+    std::sort(this->component_nodes.begin() + begin, this->component_nodes.end());
+    this->component_offsets.push_back(this->component_nodes.size());
+  }
+
+  this->dirty = false;
+  this->version++;
+}
+
+f64 LocationGraph::SetCost(u32 a, u32 b, f64 cost) {
+  // Before the first build there are no rows to look the edge up in
+  if (this->dirty) {
+    for (auto& edge : this->edges) {
+      if ((edge.a == a && edge.b == b) || (edge.a == b && edge.b == a)) {
+        f64 old_cost = edge.cost;
+        edge.cost = cost;
+        return old_cost;
+      }
+    }
+    return -1.0;
+  }
+  if (a >= this->num_nodes || b >= this->num_nodes) {
+    return -1.0;
+  }
+
+  // The edge through a's row, then its entry in b's row
+  u32 idx = NIL;
+  for (u32 i = this->offsets[a]; i < this->offsets[a + 1]; ++i) {
+    if (this->targets[i] == b) {
+      idx = this->edge_of[i];
+      this->costs[i] = cost;
+      break;
+    }
+  }
+  if (idx == NIL) {
+    return -1.0;
+  }
+  for (u32 i = this->offsets[b]; i < this->offsets[b + 1]; ++i) {
+    if (this->edge_of[i] == idx) {
+      this->costs[i] = cost;
+      break;
+    }
+  }
+  f64 old_cost = this->edges[idx].cost;
+  this->edges[idx].cost = cost;
+  this->cost_version++;
+  return old_cost;
+}
+
+void Markets::Init(usize num_locations, usize num_goods) {
+  this->num_goods = num_goods;
+  usize size = num_locations * num_goods;
+  this->supply.assign(size, 0.0);
+  this->demand.assign(size, 0.0);
+  this->imports.assign(size, 0.0);
+  this->exports.assign(size, 0.0);
+  this->price.assign(size, 0.0);
+}
+
+void UpdateNetwork(Sim& sim, const TickRequest& request, Range range) {
+  sim.location_graph.Build(sim.locations.Capacity());
+  sim.paths.Sync(sim.location_graph);
+}
+
+usize CountMarkets(const Sim& sim) {
+  return sim.locations.Capacity();
+}
+
+void ComputeMarkets(Sim& sim, const TickRequest& request, Range range) {
+  auto& markets = sim.markets;
+  usize num_goods = markets.num_goods;
+
+  for (usize idx = range.begin; idx < range.end; ++idx) {
+    for (usize good = 0; good < num_goods; ++good) {
+      usize at = markets.At(idx, good);
+      markets.supply[at] = 0.0;
+      markets.demand[at] = 0.0;
+    }
+
+    const auto& location = sim.locations[idx];
+    if (!IsValid(location)) {
+      continue;
+    }
+
+    for (const auto* building : *location.buildings_at_location) {
+      for (usize good = 0; good < num_goods; ++good) {
+        markets.supply[markets.At(idx, good)] +=
+            building->type->output[good] * building->size;
+      }
+    }
+    for (const auto* pop : *location.pops_at_location) {
+      f64 units = pop->size / POP_DEMAND_UNIT;
+      for (usize good = 0; good < num_goods; ++good) {
+        markets.demand[markets.At(idx, good)] += pop->type->demand[good] * units;
+      }
+    }
+
+    // Price follows the ratio of demand to what is available after trade
+    for (usize good = 0; good < num_goods; ++good) {
+      usize at = markets.At(idx, good);
+      f64 base = sim.good_types[good].price;
+      f64 available =
+          markets.supply[at] + markets.imports[at] - markets.exports[at];
+      f64 factor = 1.0;
+      if (markets.demand[at] > EPSILON || available > EPSILON) {
+        factor = markets.demand[at] / std::max(available, EPSILON);
+      }
+      factor = std::clamp(factor, MIN_PRICE_FACTOR, MAX_PRICE_FACTOR);
+      markets.price[at] = base * factor;
+    }
+  }
+}
+
+// Multi-source Dijkstra: for every node of the region, the closest market
+// that still has surplus to give.
+static void NearestSources(const LocationGraph& graph,
+    std::span<const u32> nodes, TradeScratch& scratch) {
+  using Entry = std::pair<f64, u32>;
+  std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> queue;
+
+  for (u32 node : nodes) {
+    scratch.dist[node] = INF;
+    scratch.origin[node] = NIL;
+    if (scratch.residual[node] > EPSILON) {
+      scratch.dist[node] = 0.0;
+      scratch.origin[node] = node;
+      queue.push({0.0, node});
+    }
+  }
+
+  while (!queue.empty()) {
+    auto [dist, node] = queue.top();
+    queue.pop();
+    if (dist > scratch.dist[node]) {
+      continue;
+    }
+    auto targets = graph.Targets(node);
+    auto costs = graph.Costs(node);
+    for (usize i = 0; i < targets.size(); ++i) {
+      u32 next = targets[i];
+      f64 next_dist = dist + costs[i];
+      if (next_dist < scratch.dist[next]) {
+        scratch.dist[next] = next_dist;
+        scratch.origin[next] = scratch.origin[node];
+        queue.push({next_dist, next});
+      }
+    }
+  }
+}
+
+// Sorts flows by market pair, summing flows between the same pair
+static void MergeFlows(std::vector<TradeFlow>& flows) {
+  std::sort(flows.begin(), flows.end(), [](const auto& a, const auto& b) {
+    return std::pair(a.from, a.to) < std::pair(b.from, b.to);
+  });
+  usize kept = 0;
+  for (usize i = 0; i < flows.size(); ++i) {
+    if (kept > 0 && flows[kept - 1].from == flows[i].from &&
+        flows[kept - 1].to == flows[i].to) {
+      flows[kept - 1].amount += flows[i].amount;
+    } else {
+      flows[kept++] = flows[i];
+    }
+  }
+  flows.resize(kept);
+}
+
+// Routes surplus to deficit markets of one region. Starts from the previous
+// solution, clamped to what is still feasible, then repeatedly ships from
+// each deficit's nearest remaining supplier, cheapest routes first. This is
+// a greedy approximation of the min-cost transportation problem.
+static void SolveRegion(Sim& sim, TradeScratch& scratch, std::span<const u32> nodes,
+    usize good, std::vector<TradeFlow>& flows) {
+  const auto& graph = sim.location_graph;
+  auto& markets = sim.markets;
+  auto& residual = scratch.residual;
+
+  for (u32 node : nodes) {
+    residual[node] = markets.Net(markets.At(node, good));
+  }
+
+  std::vector<TradeFlow> solved;
+  auto ship = [&](u32 from, u32 to, f64 amount, f64 cost) {
+    amount = std::min({amount, residual[from], -residual[to]});
+    if (amount <= EPSILON) {
+      return false;
+    }
+    residual[from] -= amount;
+    residual[to] += amount;
+    solved.push_back({from, to, amount, cost});
+    return true;
+  };
+
+  // Warm start
+  std::sort(flows.begin(), flows.end(), [](const auto& a, const auto& b) {
+    if (a.cost != b.cost) {
+      return a.cost < b.cost;
+    }
+    return std::pair(a.from, a.to) < std::pair(b.from, b.to);
+  });
+  for (const auto& flow : flows) {
+    ship(flow.from, flow.to, flow.amount, flow.cost);
+  }
+
+  struct Route {
+    f64 cost{0.0};
+    u32 from{0};
+    u32 to{0};
+  };
+  std::vector<Route> routes;
+  for (usize round = 0; round < MAX_ROUTING_ROUNDS; ++round) {
+    NearestSources(graph, nodes, scratch);
+    routes.clear();
+    for (u32 node : nodes) {
+      if (residual[node] < -EPSILON && scratch.origin[node] != NIL) {
+        routes.push_back({scratch.dist[node], scratch.origin[node], node});
+      }
+    }
+    if (routes.empty()) {
+      break;
+    }
+    std::sort(routes.begin(), routes.end(), [](const auto& a, const auto& b) {
+      return a.cost != b.cost ? a.cost < b.cost : a.to < b.to;
+    });
+    bool shipped = false;
+    for (const auto& route : routes) {
+      shipped |= ship(route.from, route.to, INF, route.cost);
+    }
+    if (!shipped) {
+      break;
+    }
+  }
+
+  MergeFlows(solved);
+  flows = std::move(solved);
+
+  for (u32 node : nodes) {
+    usize at = markets.At(node, good);
+    markets.imports[at] = 0.0;
+    markets.exports[at] = 0.0;
+    sim.trade.solved_net[at] = markets.Net(at);
+  }
+  for (const auto& flow : flows) {
+    markets.exports[markets.At(flow.from, good)] += flow.amount;
+    markets.imports[markets.At(flow.to, good)] += flow.amount;
+  }
+}
+
+// Ships between `node` and the nearest markets left with the opposite
+// balance, closest first, until its own balance is met or the search has
+// settled MAX_REPAIR_SETTLED markets
+static void RepairMarket(Sim& sim, TradeScratch& scratch, u32 node, usize good,
+    std::vector<TradeFlow>& flows) {
+  const auto& graph = sim.location_graph;
+  auto& markets = sim.markets;
+  auto residual = [&](u32 market) {
+    usize at = markets.At(market, good);
+    return markets.Net(at) - markets.exports[at] + markets.imports[at];
+  };
+  f64 need = residual(node);
+  if (std::abs(need) <= EPSILON) {
+    return;
+  }
+
+  using Entry = std::pair<f64, u32>;
+  std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> queue;
+  auto& reach = scratch.reach;
+  reach[node] = 0.0;
+  scratch.visited.push_back(node);
+  queue.push({0.0, node});
+  usize settled = 0;
+  while (!queue.empty() && settled < MAX_REPAIR_SETTLED &&
+         std::abs(need) > EPSILON) {
+    auto [dist, market] = queue.top();
+    queue.pop();
+    if (dist > reach[market]) {
+      continue;
+    }
+    settled++;
+    f64 other = residual(market);
+    if (need > 0.0 ? other < -EPSILON : other > EPSILON) {
+      f64 amount = std::min(std::abs(need), std::abs(other));
+      u32 from = need > 0.0 ? node : market;
+      u32 to = need > 0.0 ? market : node;
+      markets.exports[markets.At(from, good)] += amount;
+      markets.imports[markets.At(to, good)] += amount;
+      flows.push_back({from, to, amount, dist});
+      need += need > 0.0 ? -amount : amount;
+    }
+    auto targets = graph.Targets(market);
+    auto costs = graph.Costs(market);
+    for (usize i = 0; i < targets.size(); ++i) {
+      u32 next = targets[i];
+      f64 next_dist = dist + costs[i];
+      if (next_dist < reach[next]) {
+        if (reach[next] == INF) {
+          scratch.visited.push_back(next);
+        }
+        reach[next] = next_dist;
+        queue.push({next_dist, next});
+      }
+    }
+  }
+
+  for (u32 market : scratch.visited) {
+    reach[market] = INF;
+  }
+  scratch.visited.clear();
+}
+
+// Re-routes only around the markets whose balance moved. Their flows are
+// dropped, then they and the other ends of those flows each ship to or from
+// their nearest markets with something left over. `dirty` is ascending.
+static void RepairRegion(Sim& sim, TradeScratch& scratch,
+    std::span<const u32> dirty, usize good, std::vector<TradeFlow>& flows) {
+  auto& markets = sim.markets;
+  auto is_dirty = [&](u32 node) {
+    return std::binary_search(dirty.begin(), dirty.end(), node);
+  };
+
+  std::vector<u32> involved(dirty.begin(), dirty.end());
+  std::erase_if(flows, [&](const TradeFlow& flow) {
+    bool from = is_dirty(flow.from);
+    if (!from && !is_dirty(flow.to)) {
+      return false;
+    }
+    markets.exports[markets.At(flow.from, good)] -= flow.amount;
+    markets.imports[markets.At(flow.to, good)] -= flow.amount;
+    involved.push_back(from ? flow.to : flow.from);
+    return true;
+  });
+  // Every flow of a dirty market is gone; clear what rounding left over
+  for (u32 node : dirty) {
+    usize at = markets.At(node, good);
+    markets.imports[at] = 0.0;
+    markets.exports[at] = 0.0;
+    sim.trade.solved_net[at] = markets.Net(at);
+  }
+
+  std::sort(involved.begin(), involved.end());
+  involved.erase(std::unique(involved.begin(), involved.end()), involved.end());
+  for (u32 node : involved) {
+    RepairMarket(sim, scratch, node, good, flows);
+  }
+  MergeFlows(flows);
+}
+
+void SolveTrade(Sim& sim, const TickRequest& request, Range range) {
+  auto& graph = sim.location_graph;
+  auto& markets = sim.markets;
+  auto& trade = sim.trade;
+
+  usize num_goods = markets.num_goods;
+  usize num_regions = graph.NumComponents() * num_goods;
+
+  // A new graph invalidates every region. New costs keep the routes, so
+  // the flows stay as a warm start, priced again by the path service.
+  bool reprice = false;
+  if (trade.graph_version != graph.Version() ||
+      trade.region_flows.size() != num_regions) {
+    trade.graph_version = graph.Version();
+    trade.graph_cost_version = graph.CostVersion();
+    trade.region_flows.assign(num_regions, {});
+    trade.region_repairs.assign(num_regions, 0);
+    trade.solved_net.assign(markets.supply.size(), std::nan(""));
+    std::fill(markets.imports.begin(), markets.imports.end(), 0.0);
+    std::fill(markets.exports.begin(), markets.exports.end(), 0.0);
+  } else if (trade.graph_cost_version != graph.CostVersion()) {
+    trade.graph_cost_version = graph.CostVersion();
+    std::fill(trade.solved_net.begin(), trade.solved_net.end(), std::nan(""));
+    reprice = true;
+  }
+
+  // Dirty markets of each dirty region, as a range of `dirty_nodes`. A
+  // region never solved, or with many markets repaired, is solved in full.
+  struct DirtyRegion {
+    usize region{0};
+    usize begin{0};
+    usize end{0};
+    bool full{false};
+  };
+  std::vector<DirtyRegion> dirty;
+  std::vector<u32> dirty_nodes;
+  for (u32 component = 0; component < graph.NumComponents(); ++component) {
+    auto nodes = graph.ComponentNodes(component);
+    // Nothing to trade with
+    if (nodes.size() < 2) {
+      continue;
+    }
+    for (usize good = 0; good < num_goods; ++good) {
+      usize begin = dirty_nodes.size();
+      bool full = false;
+      for (u32 node : nodes) {
+        usize at = markets.At(node, good);
+        f64 solved = trade.solved_net[at];
+        if (std::isnan(solved)) {
+          full = true;
+          break;
+        }
+        f64 change = std::abs(markets.Net(at) - solved);
+        if (change > trade.threshold * std::max(std::abs(solved), 1.0)) {
+          dirty_nodes.push_back(node);
+        }
+      }
+      usize count = dirty_nodes.size() - begin;
+      if (!full && count == 0) {
+        continue;
+      }
+      usize region = component * num_goods + good;
+      usize& repairs = trade.region_repairs[region];
+      repairs += count;
+      if (full || repairs * FULL_SOLVE_SHARE > nodes.size()) {
+        full = true;
+        repairs = 0;
+        dirty_nodes.resize(begin);
+      }
+      dirty.push_back({region, begin, dirty_nodes.size(), full});
+    }
+  }
+
+  trade.scratch.resize(jobs::NumThreads());
+  for (auto& scratch : trade.scratch) {
+    scratch.residual.resize(graph.NumNodes());
+    scratch.dist.resize(graph.NumNodes());
+    scratch.origin.resize(graph.NumNodes());
+    scratch.reach.resize(graph.NumNodes(), INF);
+  }
+
+  // Regions touch disjoint markets, so they solve independently
+  jobs::Run(dirty.size(), [&](usize i) {
+    const auto& entry = dirty[i];
+    usize region = entry.region;
+    auto& scratch = trade.scratch[jobs::ThreadIndex()];
+    auto& flows = trade.region_flows[region];
+    if (reprice) {
+      for (auto& flow : flows) {
+        flow.cost = sim.paths.Distance(flow.from, flow.to);
+      }
+    }
+    if (entry.full) {
+      auto nodes = graph.ComponentNodes(region / num_goods);
+      SolveRegion(sim, scratch, nodes, region % num_goods, flows);
+    } else {
+      std::span<const u32> nodes(
+          dirty_nodes.data() + entry.begin, entry.end - entry.begin);
+      RepairRegion(sim, scratch, nodes, region % num_goods, flows);
+    }
+  });
+  trade.regions_solved = 0;
+  for (const auto& entry : dirty) {
+    trade.regions_solved += entry.full;
+  }
+  trade.regions_repaired = dirty.size() - trade.regions_solved;
+}
+
+} // namespace simulation